@@ -35,6 +35,9 @@
 #include <algorithm>
 #include <set>
 #include <vector>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
 #include <cfloat>
 
 using std::vector;
@@ -54,6 +57,28 @@ using std::vector;
 
 template<class T> class AStarState;
 
+// Open and closed nodes are looked up by state. A user state can make that fast by providing either:
+// - std::size_t DenseIndex() - a small unique integer per state (such as y*width+x on a grid), used to
+//   index a flat table; or
+// - std::size_t Hash() - a hash, which must be equal for any two states where IsSameState is true.
+// States providing neither are found by scanning the open and closed lists, as before.
+namespace astar_detail
+{
+	template<class T, class = void> struct has_dense_index : std::false_type {};
+	template<class T> struct has_dense_index<T, decltype(void(std::declval<T &>().DenseIndex()))> : std::true_type {};
+
+	template<class T, class = void> struct has_hash : std::false_type {};
+	template<class T> struct has_hash<T, decltype(void(std::declval<T &>().Hash()))> : std::true_type {};
+
+	struct dense_lookup_tag {};
+	struct hashed_lookup_tag {};
+	struct linear_lookup_tag {};
+
+	template<class T>
+	using lookup_tag = typename std::conditional<has_dense_index<T>::value, dense_lookup_tag,
+		typename std::conditional<has_hash<T>::value, hashed_lookup_tag, linear_lookup_tag>::type>::type;
+}
+
 // The AStar search class. UserState is the users state space type
 template<class UserState> class AStarSearch
 {
@@ -71,6 +96,9 @@ public:
 		SEARCH_STATE_INVALID
 	};
 
+	// Marks a node that is not on the open (or closed) list
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
 	// A node represents a possible state in the search
 	// The user provided state type is included inside this type
 
@@ -87,8 +115,11 @@ public:
 		float h; // heuristic estimate of distance to goal
 		float f; // sum of cumulative cost of predecessors and self and heuristic
 
+		std::size_t m_OpenIndex; // position in the open list heap, or npos
+		std::size_t m_ClosedIndex; // position in the closed list, or npos
+
 		Node() :
-				parent(0), child(0), g(0.0f), h(0.0f), f(0.0f)
+				parent(0), child(0), g(0.0f), h(0.0f), f(0.0f), m_OpenIndex(npos), m_ClosedIndex(npos)
 		{
 		}
 
@@ -161,10 +192,9 @@ public:
 
 		// Push the start node on the Open list
 
-		m_OpenList.push_back(m_Start); // heap now unsorted
-
-		// Sort back element into heap
-		push_heap(m_OpenList.begin(), m_OpenList.end(), HeapCompare_f());
+		ClearIndex();
+		AddToIndex(m_Start);
+		PushOpen(m_Start);
 
 		// Initialise counter for search steps
 		m_Steps = 0;
@@ -196,10 +226,7 @@ public:
 		m_Steps++;
 
 		// Pop the best node (the one with the lowest f) 
-		Node *n = m_OpenList.front(); // get pointer to the node
-
-		pop_heap(m_OpenList.begin(), m_OpenList.end(), HeapCompare_f());
-		m_OpenList.pop_back();
+		Node *n = PopOpen();
 
 		// Check for the goal, once we pop that we're done
 		if (n->m_UserState.IsGoal(m_Goal->m_UserState))
@@ -263,7 +290,8 @@ public:
 
 				m_Successors.clear(); // empty vector of successor nodes to n
 
-				// free up everything else we allocated
+				// n is on neither list now, so free it along with everything else we allocated
+				FreeNode(n);
 				FreeAllNodes();
 
 				m_State = SEARCH_STATE_OUT_OF_MEMORY;
@@ -280,63 +308,41 @@ public:
 				float newg = n->g
 						+ n->m_UserState.GetCost((*successor)->m_UserState);
 
-				// Now we need to find whether the node is on the open or closed lists
+				// Now we need to find whether the state is already on the open or closed lists.
 				// If it is but the node that is already on them is better (lower g)
 				// then we can forget about this successor
 
-				// First linear search of open list to find node
-
-				typename vector<Node *>::iterator openlist_result;
-
-				for (openlist_result = m_OpenList.begin();
-						openlist_result != m_OpenList.end(); openlist_result++)
-				{
-					if ((*openlist_result)->m_UserState.IsSameState(
-							(*successor)->m_UserState))
-					{
-						break;
-					}
-				}
+				Node *existing = FindNode((*successor)->m_UserState);
 
-				if (openlist_result != m_OpenList.end())
+				if (existing)
 				{
+					FreeNode((*successor));
 
-					// we found this state on open
-
-					if ((*openlist_result)->g <= newg)
+					if (existing->g <= newg)
 					{
-						FreeNode((*successor));
-
-						// the one on Open is cheaper than this one
+						// the one on Open or Closed is cheaper than this one
 						continue;
 					}
-				}
 
-				typename vector<Node *>::iterator closedlist_result;
+					// This is a better route to a state we already know about, so update the
+					// existing node in place. That keeps any nodes that use it as their parent
+					// valid, and on the open list is a decrease-key rather than a re-heap.
 
-				for (closedlist_result = m_ClosedList.begin();
-						closedlist_result != m_ClosedList.end();
-						closedlist_result++)
-				{
-					if ((*closedlist_result)->m_UserState.IsSameState(
-							(*successor)->m_UserState))
+					existing->parent = n;
+					existing->g = newg;
+					existing->f = existing->g + existing->h;
+
+					if (existing->m_OpenIndex != npos)
 					{
-						break;
+						SiftUp(existing->m_OpenIndex);
 					}
-				}
-
-				if (closedlist_result != m_ClosedList.end())
-				{
-
-					// we found this state on closed
-
-					if ((*closedlist_result)->g <= newg)
+					else if (existing->m_ClosedIndex != npos)
 					{
-						// the one on Closed is cheaper than this one
-						FreeNode((*successor));
-
-						continue;
+						// Reopen it (this only happens with inconsistent heuristics)
+						RemoveClosed(existing);
+						PushOpen(existing);
 					}
+					continue;
 				}
 
 				// This node is the best node so far with this particular state
@@ -349,49 +355,14 @@ public:
 								m_Goal->m_UserState);
 				(*successor)->f = (*successor)->g + (*successor)->h;
 
-				// Remove successor from closed if it was on it
-
-				if (closedlist_result != m_ClosedList.end())
-				{
-					// remove it from Closed
-					FreeNode((*closedlist_result));
-					m_ClosedList.erase(closedlist_result);
-
-					// Fix thanks to ...
-					// Greg Douglas <gregdouglasmail@gmail.com>
-					// who noticed that this code path was incorrect
-					// Here we have found a new state which is already CLOSED
-					// anus
-
-				}
-
-				// Update old version of this node
-				if (openlist_result != m_OpenList.end())
-				{
-
-					FreeNode((*openlist_result));
-					m_OpenList.erase(openlist_result);
-
-					// re-make the heap 
-					// make_heap rather than sort_heap is an essential bug fix
-					// thanks to Mike Ryynanen for pointing this out and then explaining
-					// it in detail. sort_heap called on an invalid heap does not work
-					make_heap(m_OpenList.begin(), m_OpenList.end(),
-							HeapCompare_f());
-
-				}
-
-				// heap now unsorted
-				m_OpenList.push_back((*successor));
-
-				// sort back element into heap
-				push_heap(m_OpenList.begin(), m_OpenList.end(),
-						HeapCompare_f());
+				AddToIndex((*successor));
+				PushOpen((*successor));
 
 			}
 
 			// push n onto Closed, as we have expanded it now
 
+			n->m_ClosedIndex = m_ClosedList.size();
 			m_ClosedList.push_back(n);
 
 		} // end else (not goal so expand)
@@ -663,6 +634,7 @@ private:
 		}
 
 		m_ClosedList.clear();
+		ClearIndex();
 
 		// delete the goal
 
@@ -710,7 +682,185 @@ private:
 		}
 
 		m_ClosedList.clear();
+		ClearIndex();
+
+	}
+
+	// Open list: a binary heap on f, in which every node records its position so that its
+	// key can be decreased in place
+
+	bool OpenLess(const Node *x, const Node *y) const
+	{
+		return x->f < y->f;
+	}
+
+	void PlaceOpen(Node *node, const std::size_t index)
+	{
+		m_OpenList[index] = node;
+		node->m_OpenIndex = index;
+	}
+
+	void SiftUp(std::size_t index)
+	{
+		Node *node = m_OpenList[index];
+		while (index > 0)
+		{
+			const std::size_t parent = (index - 1) / 2;
+			if (!OpenLess(node, m_OpenList[parent])) break;
+			PlaceOpen(m_OpenList[parent], index);
+			index = parent;
+		}
+		PlaceOpen(node, index);
+	}
+
+	void SiftDown(std::size_t index)
+	{
+		Node *node = m_OpenList[index];
+		const std::size_t size = m_OpenList.size();
+		for (;;)
+		{
+			std::size_t child = index * 2 + 1;
+			if (child >= size) break;
+			if (child + 1 < size && OpenLess(m_OpenList[child + 1], m_OpenList[child])) ++child;
+			if (!OpenLess(m_OpenList[child], node)) break;
+			PlaceOpen(m_OpenList[child], index);
+			index = child;
+		}
+		PlaceOpen(node, index);
+	}
+
+	void PushOpen(Node *node)
+	{
+		m_OpenList.push_back(node);
+		SiftUp(m_OpenList.size() - 1);
+	}
+
+	Node *PopOpen()
+	{
+		Node *top = m_OpenList.front();
+		Node *last = m_OpenList.back();
+		m_OpenList.pop_back();
+		if (!m_OpenList.empty())
+		{
+			PlaceOpen(last, 0);
+			SiftDown(0);
+		}
+		top->m_OpenIndex = npos;
+		return top;
+	}
+
+	// Closed list: order doesn't matter, so removal swaps the last node into the gap
+
+	void RemoveClosed(Node *node)
+	{
+		Node *last = m_ClosedList.back();
+		m_ClosedList[node->m_ClosedIndex] = last;
+		last->m_ClosedIndex = node->m_ClosedIndex;
+		m_ClosedList.pop_back();
+		node->m_ClosedIndex = npos;
+	}
+
+	// State lookup, chosen by what the user state provides (see astar_detail)
+
+	Node *FindNode(UserState &state)
+	{
+		return FindNode(state, astar_detail::lookup_tag<UserState>());
+	}
+
+	void AddToIndex(Node *node)
+	{
+		AddToIndex(node, astar_detail::lookup_tag<UserState>());
+	}
+
+	void ClearIndex()
+	{
+		ClearIndex(astar_detail::lookup_tag<UserState>());
+	}
+
+	Node *FindNode(UserState &state, astar_detail::dense_lookup_tag)
+	{
+		const std::size_t index = static_cast<std::size_t>(state.DenseIndex());
+		return index < m_DenseIndex.size() ? m_DenseIndex[index] : NULL;
+	}
+
+	void AddToIndex(Node *node, astar_detail::dense_lookup_tag)
+	{
+		const std::size_t index = static_cast<std::size_t>(node->m_UserState.DenseIndex());
+		if (index >= m_DenseIndex.size()) m_DenseIndex.resize(index + 1, NULL);
+		m_DenseIndex[index] = node;
+		m_DenseTouched.push_back(index);
+	}
+
+	void ClearIndex(astar_detail::dense_lookup_tag)
+	{
+		for (const std::size_t &index : m_DenseTouched) m_DenseIndex[index] = NULL;
+		m_DenseTouched.clear();
+	}
+
+	// Open addressing with linear probing; nodes are never removed until the whole index is cleared, and the
+	// table is kept at most half full
+
+	Node *FindNode(UserState &state, astar_detail::hashed_lookup_tag)
+	{
+		if (m_HashIndex.empty()) return NULL;
+		const std::size_t mask = m_HashIndex.size() - 1;
+		for (std::size_t slot = static_cast<std::size_t>(state.Hash()) & mask; m_HashIndex[slot]; slot = (slot + 1) & mask)
+		{
+			if (m_HashIndex[slot]->m_UserState.IsSameState(state)) return m_HashIndex[slot];
+		}
+		return NULL;
+	}
+
+	void AddToIndex(Node *node, astar_detail::hashed_lookup_tag)
+	{
+		if ((m_HashCount + 1) * 2 > m_HashIndex.size())
+		{
+			vector<Node *> old;
+			old.swap(m_HashIndex);
+			m_HashIndex.assign(old.empty() ? 1024 : old.size() * 2, NULL);
+			m_HashCount = 0;
+			for (Node *n : old)
+			{
+				if (n) InsertHashed(n);
+			}
+		}
+		InsertHashed(node);
+	}
+
+	void InsertHashed(Node *node)
+	{
+		const std::size_t mask = m_HashIndex.size() - 1;
+		std::size_t slot = static_cast<std::size_t>(node->m_UserState.Hash()) & mask;
+		while (m_HashIndex[slot]) slot = (slot + 1) & mask;
+		m_HashIndex[slot] = node;
+		++m_HashCount;
+	}
+
+	void ClearIndex(astar_detail::hashed_lookup_tag)
+	{
+		if (m_HashCount > 0) std::fill(m_HashIndex.begin(), m_HashIndex.end(), (Node *)NULL);
+		m_HashCount = 0;
+	}
+
+	Node *FindNode(UserState &state, astar_detail::linear_lookup_tag)
+	{
+		for (Node *node : m_OpenList)
+		{
+			if (node->m_UserState.IsSameState(state)) return node;
+		}
+		for (Node *node : m_ClosedList)
+		{
+			if (node->m_UserState.IsSameState(state)) return node;
+		}
+		return NULL;
+	}
+
+	void AddToIndex(Node *, astar_detail::linear_lookup_tag)
+	{
+	}
 
+	void ClearIndex(astar_detail::linear_lookup_tag)
+	{
 	}
 
 	// Node memory management
@@ -755,6 +905,12 @@ private:
 	// Closed list is a vector.
 	vector<Node *> m_ClosedList;
 
+	// Every node on the open or closed list, by state (only one of these is used)
+	vector<Node *> m_DenseIndex;
+	vector<std::size_t> m_DenseTouched;
+	vector<Node *> m_HashIndex;
+	std::size_t m_HashCount = 0;
+
 	// Successors is a vector filled out by the user each type successors to a node
 	// are generated
 	vector<Node *> m_Successors;
@@ -788,6 +944,8 @@ private:
 
 };
 
+template<class UserState> constexpr std::size_t AStarSearch<UserState>::npos;
+
 template<class T> class AStarState
 {
 public:
@@ -0,0 +1,262 @@
+#include "compressed_stream.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace rltk {
+
+constexpr std::size_t compressed_ostream::default_chunk_size;
+
+namespace compressed_stream_detail {
+
+/*
+ * File layout: a header, the compressed chunks back to back, the chunk and section tables, then a trailer
+ * giving the position and size of the tables.
+ */
+constexpr char stream_magic[8] = {'R', 'L', 'T', 'K', 'Z', 'C', 'H', 'K'};
+constexpr std::uint32_t stream_version = 1;
+
+struct header_t {
+	char magic[8];
+	std::uint32_t version = stream_version;
+	std::uint32_t reserved = 0;
+};
+
+struct trailer_t {
+	std::uint64_t index_offset = 0;
+	std::uint64_t chunk_count = 0;
+	std::uint64_t section_count = 0;
+	char magic[8];
+};
+
+/*
+ * Chunks are batched so that there is one per pool thread to work on.
+ */
+inline std::size_t batch_size() {
+	return std::max<std::size_t>(1, default_thread_pool().size());
+}
+
+output_buffer::output_buffer(const std::string &filename, const int level, const std::size_t chunk_size) :
+	out(filename, std::ios::out | std::ios::binary | std::ios::trunc), level(level), chunk_size(std::max<std::size_t>(1, chunk_size))
+{
+	if (!out) throw std::runtime_error("Unable to open compressed file for writing: " + filename);
+
+	header_t header;
+	std::memcpy(header.magic, stream_magic, sizeof(stream_magic));
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	offset = sizeof(header);
+	reset_put_area();
+}
+
+output_buffer::~output_buffer() {
+	try {
+		close();
+	} catch (...) {
+		// Destructors can't report failure; call close() to find out about it.
+	}
+}
+
+void output_buffer::reset_put_area() {
+	current.resize(chunk_size);
+	setp(&current[0], &current[0] + current.size());
+}
+
+std::streambuf::int_type output_buffer::overflow(int_type ch) {
+	if (closed) return traits_type::eof();
+	end_chunk();
+	if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+	}
+	return traits_type::not_eof(ch);
+}
+
+void output_buffer::end_chunk() {
+	const std::size_t used = static_cast<std::size_t>(pptr() - pbase());
+	if (used == 0) return;
+
+	chunk_t chunk;
+	chunk.raw_offset = raw_offset;
+	chunk.raw_size = used;
+	raw_offset += used;
+	chunks.push_back(chunk);
+
+	current.resize(used);
+	pending.push_back(std::move(current));
+	current = std::string();
+	reset_put_area();
+
+	if (pending.size() >= batch_size()) write_pending();
+}
+
+void output_buffer::write_pending() {
+	if (pending.empty()) return;
+
+	std::vector<std::string> compressed(pending.size());
+	default_thread_pool().parallel_for(pending.size(), [this, &compressed] (const std::size_t i) {
+		uLongf size = compressBound(static_cast<uLong>(pending[i].size()));
+		compressed[i].resize(size);
+		const int result = compress2(reinterpret_cast<Bytef *>(&compressed[i][0]), &size,
+			reinterpret_cast<const Bytef *>(pending[i].data()), static_cast<uLong>(pending[i].size()), level);
+		if (result != Z_OK) throw std::runtime_error("Unable to compress chunk");
+		compressed[i].resize(size);
+	});
+
+	const std::size_t first = chunks.size() - pending.size();
+	for (std::size_t i=0; i<compressed.size(); ++i) {
+		chunks[first + i].offset = offset;
+		chunks[first + i].compressed_size = compressed[i].size();
+		out.write(compressed[i].data(), static_cast<std::streamsize>(compressed[i].size()));
+		offset += compressed[i].size();
+	}
+	pending.clear();
+}
+
+void output_buffer::begin_section(const std::uint64_t key) {
+	if (closed) throw std::runtime_error("Compressed stream is closed");
+	end_chunk();
+	section_t section;
+	section.key = key;
+	section.raw_offset = raw_offset;
+	sections.push_back(section);
+}
+
+void output_buffer::close() {
+	if (closed) return;
+	end_chunk();
+	write_pending();
+	closed = true;
+	setp(nullptr, nullptr);
+
+	trailer_t trailer;
+	trailer.index_offset = offset;
+	trailer.chunk_count = chunks.size();
+	trailer.section_count = sections.size();
+	std::memcpy(trailer.magic, stream_magic, sizeof(stream_magic));
+	out.write(reinterpret_cast<const char *>(chunks.data()), static_cast<std::streamsize>(chunks.size() * sizeof(chunk_t)));
+	out.write(reinterpret_cast<const char *>(sections.data()), static_cast<std::streamsize>(sections.size() * sizeof(section_t)));
+	out.write(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+	out.flush();
+	if (!out) throw std::runtime_error("Error writing compressed file");
+}
+
+input_buffer::input_buffer(const std::string &filename) : in(filename, std::ios::in | std::ios::binary) {
+	if (!in) throw std::runtime_error(std::string("File not found: ") + filename);
+
+	header_t header;
+	trailer_t trailer;
+	in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	in.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end);
+	in.read(reinterpret_cast<char *>(&trailer), sizeof(trailer));
+	if (!in || std::memcmp(header.magic, stream_magic, sizeof(stream_magic)) != 0 ||
+		std::memcmp(trailer.magic, stream_magic, sizeof(stream_magic)) != 0)
+	{
+		throw std::runtime_error("Not a compressed RLTK file, or truncated: " + filename);
+	}
+	if (header.version != stream_version) throw std::runtime_error("Unsupported compressed file version: " + filename);
+
+	chunks.resize(trailer.chunk_count);
+	sections.resize(trailer.section_count);
+	in.seekg(static_cast<std::streamoff>(trailer.index_offset));
+	in.read(reinterpret_cast<char *>(chunks.data()), static_cast<std::streamsize>(chunks.size() * sizeof(chunk_t)));
+	in.read(reinterpret_cast<char *>(sections.data()), static_cast<std::streamsize>(sections.size() * sizeof(section_t)));
+	if (!in) throw std::runtime_error("Compressed file index is truncated: " + filename);
+	current = chunks.size();
+}
+
+/*
+ * Makes chunk the current get area. Reading forward decompresses a batch of chunks in parallel; seeking only
+ * decompresses the one it needs.
+ */
+void input_buffer::load_chunk(const std::size_t chunk, const bool read_ahead) {
+	if (chunk < first_decoded || chunk >= first_decoded + decoded.size()) {
+		const std::size_t count = read_ahead ? std::min(batch_size(), chunks.size() - chunk) : 1;
+		const chunk_t &last = chunks[chunk + count - 1];
+		std::string compressed(static_cast<std::size_t>(last.offset + last.compressed_size - chunks[chunk].offset), '\0');
+		in.clear();
+		in.seekg(static_cast<std::streamoff>(chunks[chunk].offset));
+		in.read(&compressed[0], static_cast<std::streamsize>(compressed.size()));
+		if (!in) throw std::runtime_error("Compressed file is truncated");
+
+		decoded.resize(count);
+		first_decoded = chunk;
+		default_thread_pool().parallel_for(count, [this, &compressed, chunk] (const std::size_t i) {
+			const chunk_t &c = chunks[chunk + i];
+			decoded[i].resize(static_cast<std::size_t>(c.raw_size));
+			uLongf size = static_cast<uLongf>(c.raw_size);
+			const int result = uncompress(reinterpret_cast<Bytef *>(&decoded[i][0]), &size,
+				reinterpret_cast<const Bytef *>(compressed.data() + (c.offset - chunks[chunk].offset)), static_cast<uLong>(c.compressed_size));
+			if (result != Z_OK || size != c.raw_size) throw std::runtime_error("Compressed file is corrupt");
+		});
+	}
+
+	current = chunk;
+	std::string &data = decoded[chunk - first_decoded];
+	setg(&data[0], &data[0], &data[0] + data.size());
+}
+
+std::uint64_t input_buffer::position() const {
+	if (current >= chunks.size()) return 0;
+	return chunks[current].raw_offset + static_cast<std::uint64_t>(gptr() - eback());
+}
+
+std::streambuf::int_type input_buffer::underflow() {
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	const std::size_t next = current >= chunks.size() ? 0 : current + 1;
+	if (next >= chunks.size()) return traits_type::eof();
+	load_chunk(next, true);
+	return traits_type::to_int_type(*gptr());
+}
+
+std::streambuf::pos_type input_buffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+	std::int64_t base = 0;
+	if (dir == std::ios_base::cur) base = static_cast<std::int64_t>(position());
+	if (dir == std::ios_base::end) base = static_cast<std::int64_t>(size());
+	return seekpos(pos_type(off_type(base + off)), which);
+}
+
+std::streambuf::pos_type input_buffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+	const std::int64_t target = static_cast<std::int64_t>(off_type(pos));
+	if (!(which & std::ios_base::in) || target < 0 || static_cast<std::uint64_t>(target) > size()) return pos_type(off_type(-1));
+	if (chunks.empty()) return pos;
+
+	// The last chunk starting at or before the target; the end of the data is the end of the last chunk
+	auto it = std::upper_bound(chunks.begin(), chunks.end(), static_cast<std::uint64_t>(target),
+		[] (const std::uint64_t &raw, const chunk_t &c) { return raw < c.raw_offset; });
+	const std::size_t chunk = static_cast<std::size_t>(it - chunks.begin()) - 1;
+	load_chunk(chunk, false);
+	setg(eback(), eback() + (target - static_cast<std::int64_t>(chunks[chunk].raw_offset)), egptr());
+	return pos;
+}
+
+bool input_buffer::seek_section(const std::uint64_t key) {
+	for (const section_t &section : sections) {
+		if (section.key == key) {
+			return seekpos(pos_type(off_type(section.raw_offset)), std::ios_base::in) != pos_type(off_type(-1));
+		}
+	}
+	return false;
+}
+
+std::vector<std::uint64_t> input_buffer::section_keys() const {
+	std::vector<std::uint64_t> result;
+	result.reserve(sections.size());
+	for (const section_t &section : sections) result.push_back(section.key);
+	return result;
+}
+
+}
+
+compressed_ostream::compressed_ostream(const std::string &filename, const int level, const std::size_t chunk_size) :
+	std::ostream(nullptr), buffer(filename, level, chunk_size)
+{
+	rdbuf(&buffer);
+}
+
+compressed_istream::compressed_istream(const std::string &filename) : std::istream(nullptr), buffer(filename) {
+	rdbuf(&buffer);
+}
+
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Chunked zlib-compressed file streams. These are ordinary std::ostream/std::istream objects, so they work
+ * anywhere a stream does - ecs_save/ecs_load, xml_writer/xml_reader, serialize/deserialize and cereal archives.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <zlib.h>
+
+namespace rltk {
+
+/*
+ * The data is split into chunks that are compressed independently, followed by an index of the chunks. That
+ * lets chunks be compressed and decompressed in parallel, and lets a reader start anywhere without inflating
+ * everything before it.
+ *
+ * Writers can also begin named sections (for example, one per component family); a section always starts a
+ * new chunk, so a reader can seek straight to it.
+ */
+namespace compressed_stream_detail {
+
+struct chunk_t {
+	std::uint64_t offset = 0;
+	std::uint64_t compressed_size = 0;
+	std::uint64_t raw_offset = 0;
+	std::uint64_t raw_size = 0;
+};
+
+struct section_t {
+	std::uint64_t key = 0;
+	std::uint64_t raw_offset = 0;
+};
+
+class output_buffer : public std::streambuf {
+public:
+	output_buffer(const std::string &filename, const int level, const std::size_t chunk_size);
+	~output_buffer();
+
+	void begin_section(const std::uint64_t key);
+	void close();
+
+protected:
+	int_type overflow(int_type ch) override;
+
+private:
+	std::ofstream out;
+	const int level;
+	const std::size_t chunk_size;
+	std::string current;
+	std::vector<std::string> pending;
+	std::vector<chunk_t> chunks;
+	std::vector<section_t> sections;
+	std::uint64_t offset = 0;
+	std::uint64_t raw_offset = 0;
+	bool closed = false;
+
+	void reset_put_area();
+	void end_chunk();
+	void write_pending();
+};
+
+class input_buffer : public std::streambuf {
+public:
+	explicit input_buffer(const std::string &filename);
+
+	bool seek_section(const std::uint64_t key);
+	std::vector<std::uint64_t> section_keys() const;
+	inline std::uint64_t size() const noexcept { return chunks.empty() ? 0 : chunks.back().raw_offset + chunks.back().raw_size; }
+
+protected:
+	int_type underflow() override;
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+	std::ifstream in;
+	std::vector<chunk_t> chunks;
+	std::vector<section_t> sections;
+	std::vector<std::string> decoded;
+	std::size_t first_decoded = 0;
+	std::size_t current = 0;
+
+	void load_chunk(const std::size_t chunk, const bool read_ahead);
+	std::uint64_t position() const;
+};
+
+}
+
+/*
+ * Writes a chunked, compressed file. level is a zlib compression level (Z_BEST_SPEED to Z_BEST_COMPRESSION);
+ * chunk_size is the amount of uncompressed data in each chunk. Full chunks are compressed in batches on the
+ * default thread pool. The file is complete once close() is called (or the stream is destroyed).
+ */
+class compressed_ostream : public std::ostream {
+public:
+	static constexpr std::size_t default_chunk_size = 256 * 1024;
+
+	compressed_ostream(const std::string &filename, const int level = Z_DEFAULT_COMPRESSION,
+		const std::size_t chunk_size = default_chunk_size);
+
+	/*
+	 * Starts a new chunk, and records that the section identified by key begins there.
+	 */
+	inline void begin_section(const std::uint64_t key) { flush(); buffer.begin_section(key); }
+
+	/*
+	 * Compresses any remaining data and writes the index.
+	 */
+	inline void close() { flush(); buffer.close(); }
+
+private:
+	compressed_stream_detail::output_buffer buffer;
+};
+
+/*
+ * Reads a file written by compressed_ostream. Reading ahead decompresses a batch of chunks on the default thread
+ * pool at a time. Seeking is supported, and only inflates the chunk containing the new position.
+ */
+class compressed_istream : public std::istream {
+public:
+	explicit compressed_istream(const std::string &filename);
+
+	/*
+	 * Moves to the start of the first section written with this key. Returns false (leaving the position
+	 * unchanged) if there is no such section.
+	 */
+	inline bool seek_section(const std::uint64_t key) {
+		clear();
+		return buffer.seek_section(key);
+	}
+
+	/*
+	 * The keys of every section in the file, in the order they were written.
+	 */
+	inline std::vector<std::uint64_t> section_keys() const { return buffer.section_keys(); }
+
+	/*
+	 * The total uncompressed size.
+	 */
+	inline std::uint64_t uncompressed_size() const noexcept { return buffer.size(); }
+
+private:
+	compressed_stream_detail::input_buffer buffer;
+};
+
+}
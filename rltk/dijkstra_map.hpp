@@ -0,0 +1,235 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Dijkstra maps (flow fields) - distances from every tile to the nearest of a set of goals.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+namespace rltk {
+
+/*
+ * A dijkstra_map computes, once, the distance from every tile of a grid to the nearest goal, along with the
+ * first step to take from each tile. Any number of agents can then head for the goals with next_step, which
+ * is a single lookup - far cheaper than a path search per agent when they share a destination (such as the
+ * player).
+ *
+ * It uses the same navigator_t as grid_path_finder: get_successors, get_cost, is_walkable, get_x, get_y,
+ * get_xy, get_width and get_height. Distances are calculated outwards from the goals, so moves are assumed to
+ * be reversible - if b is a successor of a, then a is a successor of b, at the same cost (when both are
+ * walkable).
+ *
+ * When a few tiles change (becoming walkable or not, or changing cost), pass them to update: only the tiles
+ * whose route to a goal went through a changed tile, and tiles that can now get there more cheaply, are
+ * recalculated.
+ */
+template<class location_t, class navigator_t>
+class dijkstra_map {
+public:
+	/*
+	 * Distance reported for tiles that cannot reach any goal.
+	 */
+	static constexpr float unreachable = std::numeric_limits<float>::max();
+
+	/*
+	 * Recalculates the whole map for a new set of goals. Goals that are not walkable are ignored.
+	 */
+	void build(const std::vector<location_t> &goal_list) {
+		goals = goal_list;
+		resize();
+		std::fill(distances.begin(), distances.end(), unreachable);
+		std::fill(next.begin(), next.end(), -1);
+		open.clear();
+		seed_goals(false);
+		propagate();
+	}
+
+	/*
+	 * Recalculates the parts of the map affected by changes to the given tiles.
+	 */
+	void update(const std::vector<location_t> &changed) {
+		if (navigator_t::get_width() != width || navigator_t::get_height() != height) {
+			build(goals);
+			return;
+		}
+		open.clear();
+		if (++generation == 0) {
+			std::fill(marks.begin(), marks.end(), 0);
+			generation = 1;
+		}
+
+		// Changed tiles are invalid...
+		for (location_t loc : changed) {
+			const int idx = index_of(loc);
+			if (idx >= 0) marks[idx] = generation | invalid_bit;
+		}
+		if (!changed.empty()) invalidate_dependents();
+
+		// ... and invalid tiles start again from their best valid neighbour. That includes changed tiles that
+		// became walkable (or cheaper), which then spread their improvement outwards.
+		affected.clear();
+		for (int idx=0; idx<width*height; ++idx) {
+			if (marks[idx] == (generation | invalid_bit)) {
+				distances[idx] = unreachable;
+				next[idx] = -1;
+				affected.push_back(idx);
+			}
+		}
+		seed_goals(true);
+		for (const int &idx : affected) {
+			location_t pos = location_at(idx);
+			if (!navigator_t::is_walkable(pos) || distances[idx] == 0.0f) continue;
+			successors.clear();
+			navigator_t::get_successors(pos, successors);
+			for (location_t &neighbour : successors) {
+				const int n = index_of(neighbour);
+				if (n < 0 || marks[n] == (generation | invalid_bit) || distances[n] == unreachable) continue;
+				const float d = distances[n] + navigator_t::get_cost(pos, neighbour);
+				if (d < distances[idx]) {
+					distances[idx] = d;
+					next[idx] = n;
+				}
+			}
+			if (distances[idx] != unreachable) push(idx);
+		}
+		propagate();
+	}
+
+	/*
+	 * The distance from pos to the nearest goal, or unreachable.
+	 */
+	inline float distance(location_t &pos) const {
+		const int idx = index_of(pos);
+		return idx < 0 ? unreachable : distances[idx];
+	}
+
+	/*
+	 * Sets step to the next tile on the way from pos to the nearest goal. Returns false (leaving step alone)
+	 * if pos is a goal, or can't reach one.
+	 */
+	inline bool next_step(location_t &pos, location_t &step) const {
+		const int idx = index_of(pos);
+		if (idx < 0 || next[idx] < 0) return false;
+		step = location_at(next[idx]);
+		return true;
+	}
+
+private:
+	// Marks hold the generation of the update that set them, plus whether the tile was invalidated
+	static constexpr std::uint32_t invalid_bit = 0x80000000u;
+
+	struct open_entry_t {
+		float distance;
+		int index;
+	};
+
+	struct open_compare_t {
+		bool operator()(const open_entry_t &a, const open_entry_t &b) const noexcept { return a.distance > b.distance; }
+	};
+
+	int width = 0;
+	int height = 0;
+	std::vector<location_t> goals;
+	std::vector<float> distances;
+	std::vector<int> next;
+	std::vector<std::uint32_t> marks;
+	std::uint32_t generation = 0;
+	std::vector<open_entry_t> open;
+	std::vector<location_t> successors;
+	std::vector<int> affected;
+	std::vector<int> chain;
+
+	inline int index_of(location_t &loc) const {
+		const int x = navigator_t::get_x(loc);
+		const int y = navigator_t::get_y(loc);
+		if (x < 0 || y < 0 || x >= width || y >= height) return -1;
+		return (y * width) + x;
+	}
+
+	inline location_t location_at(const int idx) const {
+		return navigator_t::get_xy(idx % width, idx / width);
+	}
+
+	void resize() {
+		width = navigator_t::get_width();
+		height = navigator_t::get_height();
+		const std::size_t size = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+		distances.resize(size);
+		next.resize(size);
+		marks.assign(size, 0);
+		generation = 0;
+	}
+
+	inline void push(const int idx) {
+		open.push_back(open_entry_t{distances[idx], idx});
+		std::push_heap(open.begin(), open.end(), open_compare_t());
+	}
+
+	void seed_goals(const bool invalid_only) {
+		for (location_t goal : goals) {
+			const int idx = index_of(goal);
+			if (idx < 0 || !navigator_t::is_walkable(goal)) continue;
+			if (invalid_only && marks[idx] != (generation | invalid_bit)) continue;
+			distances[idx] = 0.0f;
+			next[idx] = -1;
+			push(idx);
+		}
+	}
+
+	/*
+	 * Marks every tile whose route to a goal passes through an invalid tile as invalid too. Each tile's route
+	 * is followed until it reaches a tile whose state is known, and everything on the way gets that state - so
+	 * this is a single pass, however long the routes are.
+	 */
+	void invalidate_dependents() {
+		const std::uint32_t valid = generation;
+		const std::uint32_t invalid = generation | invalid_bit;
+		for (int idx=0; idx<width*height; ++idx) {
+			chain.clear();
+			int current = idx;
+			while (current >= 0 && marks[current] != valid && marks[current] != invalid) {
+				chain.push_back(current);
+				current = next[current];
+			}
+			const std::uint32_t state = (current >= 0 && marks[current] == invalid) ? invalid : valid;
+			for (const int &c : chain) marks[c] = state;
+		}
+	}
+
+	void propagate() {
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), open_compare_t());
+			const open_entry_t top = open.back();
+			open.pop_back();
+			if (top.distance > distances[top.index]) continue; // A better route was found since this was queued
+
+			location_t pos = location_at(top.index);
+			successors.clear();
+			navigator_t::get_successors(pos, successors);
+			for (location_t &neighbour : successors) {
+				const int n = index_of(neighbour);
+				if (n < 0 || !navigator_t::is_walkable(neighbour)) continue;
+				const float d = top.distance + navigator_t::get_cost(neighbour, pos);
+				if (d < distances[n]) {
+					distances[n] = d;
+					next[n] = top.index;
+					push(n);
+				}
+			}
+		}
+	}
+};
+
+template<class location_t, class navigator_t>
+constexpr float dijkstra_map<location_t, navigator_t>::unreachable;
+
+template<class location_t, class navigator_t>
+constexpr std::uint32_t dijkstra_map<location_t, navigator_t>::invalid_bit;
+
+}
@@ -1,6 +1,17 @@
 #include "ecs.hpp"
+#include "thread_pool.hpp"
 #include <cereal/types/polymorphic.hpp>
 #include <cereal/archives/binary.hpp>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <iterator>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace rltk {
 
@@ -8,43 +19,43 @@ std::size_t impl::base_component_t::type_counter = 1;
 std::size_t base_message_t::type_counter = 1;
 std::size_t entity_t::entity_counter{1}; // Not using zero since it is used as null so often
 ecs default_ecs;
+thread_local impl::deferred_staging_t * impl::current_staging = nullptr;
+constexpr std::size_t impl::entity_table_t::page_size;
+constexpr std::size_t impl::entity_table_t::npos;
 
 entity_t * ecs::entity(const std::size_t id) noexcept {
-	entity_t * result = nullptr;
-	auto finder = entity_store.find(id);
-	if (finder == entity_store.end()) return result;
-	if (finder->second.deleted) return result;
-	result = &finder->second;
+	entity_t * result = entity_store.find(id);
+	if (result && result->deleted) result = nullptr;
 	return result;
 }
 
 entity_t * ecs::create_entity() {
     entity_t new_entity;
-    while (entity_store.find(new_entity.id) != entity_store.end()) {
+    while (entity_store.find(new_entity.id) != nullptr) {
         ++entity_t::entity_counter;
         new_entity.id = entity_t::entity_counter;
     }
     //std::cout << "New Entity ID#: " << new_entity.id << "\n";
 
-    entity_store.emplace(new_entity.id, new_entity);
-    return entity(new_entity.id);
+    if (change_tracking) created_since_checkpoint.push_back(new_entity.id);
+    return entity_store.insert(new_entity);
 }
 
 entity_t * ecs::create_entity(const std::size_t new_id) {
 	entity_t new_entity(new_id);
-    if (entity_store.find(new_entity.id) != entity_store.end()) {
+    if (entity_store.find(new_entity.id) != nullptr) {
         throw std::runtime_error("WARNING: Duplicate entity ID. Odd things will happen\n");
     }
-	entity_store.emplace(new_entity.id, new_entity);
-	return entity(new_entity.id);
+	if (change_tracking) created_since_checkpoint.push_back(new_entity.id);
+	return entity_store.insert(new_entity);
 }
 
 void ecs::each(std::function<void(entity_t &)> &&func) {
-	for (auto it=entity_store.begin(); it!=entity_store.end(); ++it) {
-		if (!it->second.deleted) {
-			func(it->second);
+	entity_store.for_each([&func] (entity_t &e) {
+		if (!e.deleted) {
+			func(e);
 		}
-	}
+	});
 }
 
 
@@ -52,12 +63,14 @@ void ecs::delete_all_systems() {
 	system_store.clear();
 	system_profiling.clear();
 	pubsub_holder.clear();
+	schedule_dirty = true;
 }
 
 void ecs::ecs_configure() {
 	for (std::unique_ptr<base_system> & sys : system_store) {
 		sys->configure();
 	}
+	schedule_dirty = true;
 }
 
 void ecs::ecs_tick(const double duration_ms) {
@@ -74,22 +87,499 @@ void ecs::ecs_tick(const double duration_ms) {
 		if (duration < system_profiling[count].best) system_profiling[count].best = duration;
 		++count;
 	}
-	ecs_garbage_collect();
+	ecs_garbage_collect(gc_budget);
+}
+
+void ecs::ecs_tick_parallel(const double duration_ms) {
+	const std::size_t n_systems = system_store.size();
+
+	// Build the dependency graph: a system waits for every earlier system it conflicts with.
+	if (schedule_dirty) {
+		schedule_successors.assign(n_systems, std::vector<std::size_t>());
+		schedule_dependencies.assign(n_systems, 0);
+		for (std::size_t i=0; i<n_systems; ++i) {
+			for (std::size_t j=i+1; j<n_systems; ++j) {
+				if (system_store[i]->access.conflicts_with(system_store[j]->access)) {
+					schedule_successors[i].push_back(j);
+					++schedule_dependencies[j];
+				}
+			}
+		}
+		schedule_dirty = false;
+	}
+
+	thread_pool &pool = default_thread_pool();
+	std::vector<std::atomic<std::size_t>> waiting_on(n_systems);
+	for (std::size_t i=0; i<n_systems; ++i) waiting_on[i] = schedule_dependencies[i];
+	std::vector<impl::deferred_staging_t> staging(n_systems);
+	std::atomic<std::size_t> outstanding{n_systems};
+	std::mutex error_lock;
+	std::exception_ptr error;
+
+	std::function<void(std::size_t)> run_system = [&] (std::size_t idx) {
+		std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+		impl::deferred_staging_t * previous = impl::current_staging;
+		try {
+			impl::current_staging = &staging[idx];
+			system_store[idx]->update(duration_ms);
+			impl::current_staging = previous;
+
+			// Deliver this system's deferred messages in type order, preserving emission order within a type
+			std::stable_sort(staging[idx].messages.begin(), staging[idx].messages.end(),
+				[] (const auto &a, const auto &b) { return a.first < b.first; });
+			for (auto &msg : staging[idx].messages) msg.second();
+		} catch (...) {
+			impl::current_staging = previous;
+			std::lock_guard<std::mutex> guard(error_lock);
+			if (!error) error = std::current_exception();
+		}
+		std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+		double duration = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count());
+
+		system_profiling[idx].last = duration;
+		if (duration > system_profiling[idx].worst) system_profiling[idx].worst = duration;
+		if (duration < system_profiling[idx].best) system_profiling[idx].best = duration;
+
+		for (const std::size_t &next : schedule_successors[idx]) {
+			if (--waiting_on[next] == 0) pool.submit([&run_system, next] () { run_system(next); });
+		}
+		--outstanding;
+	};
+
+	for (std::size_t i=0; i<n_systems; ++i) {
+		if (schedule_dependencies[i] == 0) pool.submit([&run_system, i] () { run_system(i); });
+	}
+	pool.wait_until([&outstanding] () { return outstanding == 0; });
+	if (error) std::rethrow_exception(error);
+
+	deliver_messages();
+	ecs_garbage_collect(gc_budget);
 }
 
 void ecs::ecs_save(std::unique_ptr<std::ofstream> &lbfile) {
-    cereal::BinaryOutputArchive oarchive(*lbfile);
+	ecs_save(*lbfile);
+}
+
+void ecs::ecs_save(std::ostream &lbfile) {
+	if (change_tracking) ecs_checkpoint();
+    cereal::BinaryOutputArchive oarchive(lbfile);
     oarchive(*this);
 }
 
 void ecs::ecs_load(std::unique_ptr<std::ifstream> &lbfile) {
+	ecs_load(*lbfile);
+}
+
+void ecs::ecs_load(std::istream &lbfile) {
 	entity_store.clear();
 	component_store.clear();
-    cereal::BinaryInputArchive iarchive(*lbfile);
+	pending_deletions.clear();
+    cereal::BinaryInputArchive iarchive(lbfile);
     iarchive(*this);
+	entity_store.for_each([this] (entity_t &e) {
+		if (e.deleted) pending_deletions.push_back(e.id);
+	});
+	ecs_checkpoint();
     std::cout << "Loaded " << entity_store.size() << " entities, and " << component_store.size() << " component types.\n";
 }
 
+namespace {
+
+constexpr char snapshot_magic[8] = {'R', 'L', 'T', 'K', 'S', 'N', 'A', 'P'};
+constexpr char delta_magic[8] = {'R', 'L', 'T', 'K', 'D', 'E', 'L', 'T'};
+constexpr std::uint32_t snapshot_version = 2;
+constexpr std::uint32_t snapshot_byte_order = 0x01020304;
+
+struct snapshot_header_t {
+	char magic[8] = {};
+	std::uint32_t version = snapshot_version;
+	std::uint32_t byte_order = snapshot_byte_order;
+	std::uint32_t word_size = sizeof(std::size_t);
+	std::uint32_t reserved = 0;
+	std::uint64_t entity_counter = 0;
+	std::uint64_t section_count = 0;
+};
+
+/*
+ * A read-only view of a whole file. Memory-mapped where the platform supports it, so that snapshot columns are
+ * copied straight out of the page cache; elsewhere, the file is read into memory.
+ */
+class mapped_file {
+public:
+	explicit mapped_file(const std::string &filename) {
+#if defined(_WIN32)
+		std::ifstream in(filename, std::ios::binary);
+		if (!in) throw std::runtime_error("Unable to open snapshot file: " + filename);
+		buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		bytes = buffer.data();
+		length = buffer.size();
+#else
+		const int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("Unable to open snapshot file: " + filename);
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			throw std::runtime_error("Unable to read snapshot file: " + filename);
+		}
+		length = static_cast<std::size_t>(info.st_size);
+		void * mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) throw std::runtime_error("Unable to map snapshot file: " + filename);
+		madvise(mapping, length, MADV_SEQUENTIAL);
+		bytes = static_cast<const char *>(mapping);
+#endif
+	}
+
+	~mapped_file() {
+#if !defined(_WIN32)
+		munmap(const_cast<char *>(bytes), length);
+#endif
+	}
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	inline const char * data() const noexcept { return bytes; }
+	inline std::size_t size() const noexcept { return length; }
+
+private:
+	const char * bytes = nullptr;
+	std::size_t length = 0;
+#if defined(_WIN32)
+	std::vector<char> buffer;
+#endif
+};
+
+inline snapshot_header_t read_snapshot_header(impl::snapshot_reader &in, const char * magic, const std::string &filename) {
+	const snapshot_header_t header = *in.column<snapshot_header_t>(1);
+	if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0) {
+		throw std::runtime_error("Not an RLTK snapshot of the expected type: " + filename);
+	}
+	if (header.version != snapshot_version) throw std::runtime_error("Unsupported snapshot version: " + filename);
+	if (header.byte_order != snapshot_byte_order || header.word_size != sizeof(std::size_t)) {
+		throw std::runtime_error("Snapshot was written on an incompatible platform: " + filename);
+	}
+	return header;
+}
+
+/*
+ * Creates an empty store for a component family, using the factory registered when the family was allocated.
+ */
+inline std::unique_ptr<impl::base_component_store> make_store(const std::size_t family, const std::string &filename) {
+	const auto &factories = impl::component_store_factories();
+	if (family >= factories.size() || !factories[family]) {
+		throw std::runtime_error("Snapshot contains a component type this program has not used: " + filename);
+	}
+	return factories[family]();
+}
+
+/*
+ * The table of contents follows the header: one entry per section, giving its position in the file so that
+ * sections can be read independently.
+ */
+struct snapshot_toc_entry_t {
+	std::uint32_t kind = 0;
+	std::uint32_t reserved = 0;
+	std::uint64_t family_id = 0;
+	std::uint64_t offset = 0;
+	std::uint64_t size = 0;
+};
+
+/*
+ * A section waiting to be written; encode fills in bytes.
+ */
+struct pending_section_t {
+	std::uint32_t kind;
+	std::uint64_t family_id;
+	std::function<void(impl::snapshot_writer &)> encode;
+	std::string bytes;
+};
+
+/*
+ * Encodes each section into its own buffer in parallel, then writes the header, the table of contents and the
+ * sections to the file.
+ */
+void write_snapshot(const std::string &filename, snapshot_header_t header, std::vector<pending_section_t> &sections) {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) throw std::runtime_error("Unable to open snapshot file for writing: " + filename);
+
+	default_thread_pool().parallel_for(sections.size(), [&sections] (const std::size_t i) {
+		std::ostringstream buffer;
+		impl::snapshot_writer section_writer(buffer);
+		sections[i].encode(section_writer);
+		sections[i].bytes = buffer.str();
+	});
+
+	auto aligned = [] (const std::size_t n) {
+		return (n + impl::snapshot_alignment - 1) / impl::snapshot_alignment * impl::snapshot_alignment;
+	};
+	header.section_count = sections.size();
+	std::vector<snapshot_toc_entry_t> toc(sections.size());
+	std::uint64_t offset = aligned(sizeof(snapshot_header_t)) + aligned(sizeof(snapshot_toc_entry_t) * toc.size());
+	for (std::size_t i=0; i<sections.size(); ++i) {
+		toc[i].kind = sections[i].kind;
+		toc[i].family_id = sections[i].family_id;
+		toc[i].offset = offset;
+		toc[i].size = sections[i].bytes.size();
+		offset += sections[i].bytes.size();
+	}
+
+	impl::snapshot_writer writer(out);
+	writer.write(&header, sizeof(header));
+	writer.align();
+	writer.column(toc.data(), toc.size());
+	for (const pending_section_t &section : sections) {
+		// Sections are padded to the alignment already, so they stay aligned back to back
+		writer.write(section.bytes.data(), section.bytes.size());
+	}
+
+	out.flush();
+	if (!out) throw std::runtime_error("Error writing snapshot file: " + filename);
+}
+
+/*
+ * Checks the header and table of contents of a mapped snapshot, and returns the table.
+ */
+std::vector<snapshot_toc_entry_t> read_snapshot_toc(const mapped_file &file, const char * magic, const std::string &filename,
+	snapshot_header_t &header)
+{
+	impl::snapshot_reader in(file.data(), file.size());
+	header = read_snapshot_header(in, magic, filename);
+	const snapshot_toc_entry_t * first = in.column<snapshot_toc_entry_t>(header.section_count);
+	std::vector<snapshot_toc_entry_t> toc(first, first + header.section_count);
+	for (const snapshot_toc_entry_t &entry : toc) {
+		if (entry.offset > file.size() || entry.size > file.size() - entry.offset || entry.offset % impl::snapshot_alignment != 0) {
+			throw std::runtime_error("Snapshot is truncated or corrupt: " + filename);
+		}
+	}
+	return toc;
+}
+
+inline impl::snapshot_reader section_reader(const mapped_file &file, const snapshot_toc_entry_t &entry) {
+	return impl::snapshot_reader(file.data() + entry.offset, entry.size);
+}
+
+/*
+ * Entities are stored as columns of IDs, deleted flags and component masks (a fixed number of words each).
+ */
+void encode_entities(impl::entity_table_t &entity_store, impl::snapshot_writer &writer) {
+	const std::size_t n = entity_store.size();
+	std::vector<std::size_t> ids;
+	std::vector<std::uint8_t> deleted;
+	std::size_t words = impl::component_mask_t::inline_words;
+	ids.reserve(n);
+	deleted.reserve(n);
+	entity_store.for_each([&ids, &deleted, &words] (entity_t &e) {
+		ids.push_back(e.id);
+		deleted.push_back(e.deleted ? 1 : 0);
+		words = std::max(words, e.component_mask.word_count());
+	});
+	std::vector<std::uint64_t> masks(n * words);
+	std::size_t i = 0;
+	entity_store.for_each([&masks, &words, &i] (entity_t &e) {
+		for (std::size_t w=0; w<words; ++w) masks[i*words + w] = e.component_mask.word(w);
+		++i;
+	});
+
+	impl::snapshot_section_t entities;
+	entities.kind = impl::SNAPSHOT_ENTITIES;
+	entities.layout = impl::SNAPSHOT_RAW;
+	entities.element_size = words;
+	entities.counts[0] = n;
+	writer.section(entities);
+	writer.column(ids.data(), ids.size());
+	writer.column(deleted.data(), deleted.size());
+	writer.column(masks.data(), masks.size());
+}
+
+void decode_entities(impl::entity_table_t &entity_store, std::deque<std::size_t> &pending_deletions, impl::snapshot_reader &in,
+	const impl::snapshot_section_t &section)
+{
+	const std::size_t n = section.counts[0];
+	const std::size_t words = section.element_size;
+	const std::size_t * ids = in.column<std::size_t>(n);
+	const std::uint8_t * deleted = in.column<std::uint8_t>(n);
+	const std::uint64_t * masks = in.column<std::uint64_t>(n * words);
+	for (std::size_t i=0; i<n; ++i) {
+		entity_t e(ids[i]);
+		e.deleted = deleted[i] != 0;
+		for (std::size_t w=0; w<words; ++w) e.component_mask.set_word(w, masks[i*words + w]);
+		entity_store.insert(e);
+		if (e.deleted) pending_deletions.push_back(e.id);
+	}
+}
+
+}
+
+void ecs::ecs_save_snapshot(const std::string &filename) {
+	if (change_tracking) ecs_checkpoint();
+
+	snapshot_header_t header;
+	std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+	header.entity_counter = entity_t::entity_counter;
+
+	std::vector<pending_section_t> sections;
+	sections.push_back(pending_section_t{impl::SNAPSHOT_ENTITIES, 0, [this] (impl::snapshot_writer &writer) {
+		encode_entities(entity_store, writer);
+	}, std::string()});
+	for (std::size_t family=0; family<component_store.size(); ++family) {
+		impl::base_component_store * store = component_store[family].get();
+		if (!store) continue;
+		sections.push_back(pending_section_t{impl::SNAPSHOT_COMPONENTS, family, [store, family] (impl::snapshot_writer &writer) {
+			store->save_snapshot(writer, family);
+		}, std::string()});
+	}
+
+	write_snapshot(filename, header, sections);
+}
+
+void ecs::ecs_load_snapshot(const std::string &filename) {
+	mapped_file file(filename);
+	snapshot_header_t header;
+	const std::vector<snapshot_toc_entry_t> toc = read_snapshot_toc(file, snapshot_magic, filename, header);
+
+	// Existing stores are re-used, so that per-store settings survive loading
+	std::vector<std::unique_ptr<impl::base_component_store>> previous = std::move(component_store);
+	component_store.clear();
+	entity_store.clear();
+	pending_deletions.clear();
+
+	// Find a store for each section first, so that the sections can then be decoded independently
+	std::vector<impl::base_component_store *> targets(toc.size(), nullptr);
+	for (std::size_t i=0; i<toc.size(); ++i) {
+		if (toc[i].kind == impl::SNAPSHOT_ENTITIES) continue;
+		if (toc[i].kind != impl::SNAPSHOT_COMPONENTS) throw std::runtime_error("Unknown snapshot section: " + filename);
+
+		const std::size_t family = toc[i].family_id;
+		if (component_store.size() <= family) component_store.resize(family+1);
+		if (component_store[family]) throw std::runtime_error("Snapshot contains a component type twice: " + filename);
+		if (family < previous.size() && previous[family]) {
+			component_store[family] = std::move(previous[family]);
+		} else {
+			component_store[family] = make_store(family, filename);
+		}
+		targets[i] = component_store[family].get();
+	}
+
+	default_thread_pool().parallel_for(toc.size(), [this, &file, &toc, &targets] (const std::size_t i) {
+		impl::snapshot_reader in = section_reader(file, toc[i]);
+		const impl::snapshot_section_t section = *in.column<impl::snapshot_section_t>(1);
+		if (targets[i]) {
+			targets[i]->load_snapshot(in, section);
+		} else {
+			decode_entities(entity_store, pending_deletions, in, section);
+		}
+	});
+
+	entity_t::entity_counter = header.entity_counter;
+	ecs_checkpoint();
+}
+
+void ecs::ecs_track_changes(const bool enabled) {
+	change_tracking = enabled;
+	ecs_checkpoint();
+}
+
+void ecs::ecs_checkpoint() {
+	created_since_checkpoint.clear();
+	deleted_since_checkpoint.clear();
+	for (auto &store : component_store) {
+		if (!store) continue;
+		store->track_changes = change_tracking;
+		if (change_tracking) {
+			store->clear_changes();
+		} else {
+			store->removed_ids.clear();
+		}
+	}
+}
+
+void ecs::ecs_save_delta(const std::string &filename) {
+	if (!change_tracking) throw std::runtime_error("Delta saves require change tracking; call ecs_track_changes first");
+
+	snapshot_header_t header;
+	std::memcpy(header.magic, delta_magic, sizeof(delta_magic));
+	header.entity_counter = entity_t::entity_counter;
+
+	std::vector<pending_section_t> sections;
+	sections.push_back(pending_section_t{impl::SNAPSHOT_ENTITY_DELTA, 0, [this] (impl::snapshot_writer &writer) {
+		impl::snapshot_section_t entities;
+		entities.kind = impl::SNAPSHOT_ENTITY_DELTA;
+		entities.counts[0] = created_since_checkpoint.size();
+		entities.counts[1] = deleted_since_checkpoint.size();
+		writer.section(entities);
+		writer.column(created_since_checkpoint.data(), created_since_checkpoint.size());
+		writer.column(deleted_since_checkpoint.data(), deleted_since_checkpoint.size());
+	}, std::string()});
+	for (std::size_t family=0; family<component_store.size(); ++family) {
+		impl::base_component_store * store = component_store[family].get();
+		if (!store) continue;
+		sections.push_back(pending_section_t{impl::SNAPSHOT_COMPONENT_DELTA, family, [store, family] (impl::snapshot_writer &writer) {
+			store->save_delta(writer, family);
+		}, std::string()});
+	}
+
+	write_snapshot(filename, header, sections);
+	created_since_checkpoint.clear();
+	deleted_since_checkpoint.clear();
+}
+
+/*
+ * Deltas are applied in order rather than in parallel, since component changes update entity masks.
+ */
+void ecs::ecs_apply_delta(const std::string &filename) {
+	mapped_file file(filename);
+	snapshot_header_t header;
+	const std::vector<snapshot_toc_entry_t> toc = read_snapshot_toc(file, delta_magic, filename, header);
+
+	std::vector<std::size_t> removed, added;
+	for (const snapshot_toc_entry_t &entry : toc) {
+		impl::snapshot_reader in = section_reader(file, entry);
+		const impl::snapshot_section_t section = *in.column<impl::snapshot_section_t>(1);
+
+		if (section.kind == impl::SNAPSHOT_ENTITY_DELTA) {
+			const std::size_t * created = in.column<std::size_t>(section.counts[0]);
+			const std::size_t * deleted = in.column<std::size_t>(section.counts[1]);
+			for (std::size_t i=0; i<section.counts[0]; ++i) {
+				if (!entity_store.find(created[i])) create_entity(created[i]);
+			}
+			for (std::size_t i=0; i<section.counts[1]; ++i) delete_entity(deleted[i]);
+		} else if (section.kind == impl::SNAPSHOT_COMPONENT_DELTA) {
+			const std::size_t family = section.family_id;
+			if (component_store.size() <= family) component_store.resize(family+1);
+			if (!component_store[family]) {
+				component_store[family] = make_store(family, filename);
+				component_store[family]->track_changes = change_tracking;
+			}
+			removed.clear();
+			added.clear();
+			component_store[family]->load_delta(in, section, removed, added);
+			for (const std::size_t &id : removed) {
+				entity_t * e = entity_store.find(id);
+				if (e) e->component_mask.reset(family);
+			}
+			for (const std::size_t &id : added) {
+				entity_t * e = entity_store.find(id);
+				if (e) e->component_mask.set(family);
+			}
+		} else {
+			throw std::runtime_error("Unknown delta section: " + filename);
+		}
+	}
+
+	entity_t::entity_counter = std::max(entity_t::entity_counter, static_cast<std::size_t>(header.entity_counter));
+}
+
+void ecs_compact_snapshot(const std::string &base, const std::vector<std::string> &deltas, const std::string &output) {
+	const std::size_t entity_counter = entity_t::entity_counter;
+	ecs scratch;
+	scratch.ecs_load_snapshot(base);
+	for (const std::string &delta : deltas) scratch.ecs_apply_delta(delta);
+	scratch.ecs_garbage_collect();
+	scratch.ecs_save_snapshot(output);
+	entity_t::entity_counter = entity_counter;
+}
+
 std::string ecs::ecs_profile_dump() {
 	std::stringstream ss;
 	ss.precision(3);
@@ -13,12 +13,16 @@
 #include <sstream>
 #include <iomanip>
 #include <queue>
+#include <deque>
 #include <future>
 #include <mutex>
 #include <typeinfo>
 #include <atomic>
+#include <thread>
+#include <iterator>
 #include "serialization_utils.hpp"
 #include "xml.hpp"
+#include "thread_pool.hpp"
 #include <cereal/types/polymorphic.hpp>
 #include "ecs_impl.hpp"
 
@@ -86,6 +90,16 @@ namespace rltk {
         delete_component<C>(default_ecs, entity_id, delete_entity_if_empty);
     }
 
+    template<class C>
+    inline void preserve_component_order(ecs &ECS, const bool stable=true) {
+        ECS.preserve_component_order<C>(stable);
+    }
+
+    template<class C>
+    inline void preserve_component_order(const bool stable=true) {
+        preserve_component_order<C>(default_ecs, stable);
+    }
+
     template<class C>
     inline std::vector<entity_t *> entities_with_component(ecs &ECS) {
         return ECS.entities_with_component<C>();
@@ -116,6 +130,16 @@ namespace rltk {
         each<Cs...>(default_ecs, callback);
     }
 
+    template <typename... Cs, typename F>
+    inline void parallel_each(ecs &ECS, F callback) {
+        ECS.parallel_each<Cs...>(callback);
+    }
+
+    template <typename... Cs, typename F>
+    inline void parallel_each(F callback) {
+        parallel_each<Cs...>(default_ecs, callback);
+    }
+
     template <typename... Cs, typename P, typename F>
     inline void each_if(ecs &ECS, P&& predicate, F callback) {
         ECS.each_if<Cs...>(predicate, callback);
@@ -134,6 +158,14 @@ namespace rltk {
         ecs_garbage_collect(default_ecs);
     }
 
+    inline void ecs_garbage_collect(ecs &ECS, const std::size_t max_entities) {
+        ECS.ecs_garbage_collect(max_entities);
+    }
+
+    inline void ecs_garbage_collect(const std::size_t max_entities) {
+        ecs_garbage_collect(default_ecs, max_entities);
+    }
+
     template <class MSG>
     inline void emit(ecs &ECS, MSG message) {
         ECS.emit<MSG>(message);
@@ -188,6 +220,14 @@ namespace rltk {
         ecs_tick(default_ecs, duration_ms);
     }
 
+    inline void ecs_tick_parallel(ecs &ECS, const double duration_ms) {
+        ECS.ecs_tick_parallel(duration_ms);
+    }
+
+    inline void ecs_tick_parallel(const double duration_ms) {
+        ecs_tick_parallel(default_ecs, duration_ms);
+    }
+
     inline void ecs_save(ecs &ECS, std::unique_ptr<std::ofstream> &lbfile) {
         ECS.ecs_save(lbfile);
     }
@@ -204,6 +244,76 @@ namespace rltk {
         ecs_load(default_ecs, lbfile);
     }
 
+    inline void ecs_save(ecs &ECS, std::ostream &lbfile) {
+        ECS.ecs_save(lbfile);
+    }
+
+    inline void ecs_save(std::ostream &lbfile) {
+        ecs_save(default_ecs, lbfile);
+    }
+
+    inline void ecs_load(ecs &ECS, std::istream &lbfile) {
+        ECS.ecs_load(lbfile);
+    }
+
+    inline void ecs_load(std::istream &lbfile) {
+        ecs_load(default_ecs, lbfile);
+    }
+
+    inline void ecs_save_snapshot(ecs &ECS, const std::string &filename) {
+        ECS.ecs_save_snapshot(filename);
+    }
+
+    inline void ecs_save_snapshot(const std::string &filename) {
+        ecs_save_snapshot(default_ecs, filename);
+    }
+
+    inline void ecs_load_snapshot(ecs &ECS, const std::string &filename) {
+        ECS.ecs_load_snapshot(filename);
+    }
+
+    inline void ecs_load_snapshot(const std::string &filename) {
+        ecs_load_snapshot(default_ecs, filename);
+    }
+
+    inline void ecs_track_changes(ecs &ECS, const bool enabled=true) {
+        ECS.ecs_track_changes(enabled);
+    }
+
+    inline void ecs_track_changes(const bool enabled=true) {
+        ecs_track_changes(default_ecs, enabled);
+    }
+
+    inline void ecs_checkpoint(ecs &ECS) {
+        ECS.ecs_checkpoint();
+    }
+
+    inline void ecs_checkpoint() {
+        ecs_checkpoint(default_ecs);
+    }
+
+    inline void ecs_save_delta(ecs &ECS, const std::string &filename) {
+        ECS.ecs_save_delta(filename);
+    }
+
+    inline void ecs_save_delta(const std::string &filename) {
+        ecs_save_delta(default_ecs, filename);
+    }
+
+    inline void ecs_apply_delta(ecs &ECS, const std::string &filename) {
+        ECS.ecs_apply_delta(filename);
+    }
+
+    inline void ecs_apply_delta(const std::string &filename) {
+        ecs_apply_delta(default_ecs, filename);
+    }
+
+    /*
+     * Folds a chain of deltas into the full snapshot they were taken against, writing a new full snapshot (as
+     * ecs_save_snapshot would) to output. This is done in a scratch ECS, so the live ones are untouched.
+     */
+    void ecs_compact_snapshot(const std::string &base, const std::vector<std::string> &deltas, const std::string &output);
+
     inline std::string ecs_profile_dump(ecs &ECS) {
         return ECS.ecs_profile_dump();
     }
@@ -3,8 +3,15 @@
 #include <cereal/cereal.hpp>
 #include <cereal/types/memory.hpp>
 #include <cereal/types/unordered_map.hpp>
-#include <cereal/types/bitset.hpp>
+#include <cereal/types/array.hpp>
 #include <cereal/types/vector.hpp>
+#include <cereal/types/bitset.hpp>
+#include <cereal/archives/binary.hpp>
+#include <limits>
+#include <array>
+#include <cstdint>
+#include <bitset>
+#include <stdexcept>
 
 namespace rltk {
 
@@ -50,16 +57,265 @@ namespace rltk {
     namespace impl {
 
         /*
-         * Constant defining the maximum number of components to support. This sizes the bitsets,
-         * so we don't want it to be much bigger than needed.
+         * The number of component types whose bits are stored inline in each entity's component mask. Types
+         * beyond this still work, but their bits spill into a heap-allocated extension. To change it, define
+         * RLTK_ECS_INLINE_COMPONENTS for the whole build (the CMake cache variable of the same name does this);
+         * every translation unit must agree on it.
+         */
+#ifndef RLTK_ECS_INLINE_COMPONENTS
+#define RLTK_ECS_INLINE_COMPONENTS 128
+#endif
+        constexpr std::size_t INLINE_COMPONENTS = RLTK_ECS_INLINE_COMPONENTS;
+
+        /*
+         * ecs_save stores each entity's component mask as a std::bitset of this many bits, as it always has, so
+         * that older saves still load. Saving an entity with a component family beyond it is an error; binary
+         * snapshots have no such limit.
          */
         constexpr std::size_t MAX_COMPONENTS = 128;
 
+        /*
+         * Marker for "no index/slot".
+         */
+        constexpr std::size_t NO_INDEX = std::numeric_limits<std::size_t>::max();
+
+        /*
+         * Parallel iteration splits work on cache-line boundaries, so that threads don't share lines.
+         */
+        constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+        /* The smallest number of T that occupies a whole number of cache lines */
+        template <class T>
+        constexpr std::size_t items_per_cache_line(const std::size_t n = 1) {
+            return (n * sizeof(T)) % CACHE_LINE_SIZE == 0 ? n : items_per_cache_line<T>(n + 1);
+        }
+
         /*
          * If the current component set does not support serialization, this will become true.
          */
         static bool ecs_supports_serialization = true;
 
+        /*
+         * A bitset with one bit per component family. The first INLINE_COMPONENTS bits live inside the mask;
+         * any higher bits go into a spill vector that is only allocated when one of them is set. Matching a
+         * query is a handful of word ANDs.
+         */
+        class component_mask_t {
+        public:
+            static constexpr std::size_t word_bits = 64;
+            static constexpr std::size_t inline_words = (INLINE_COMPONENTS + word_bits - 1) / word_bits;
+
+            inline void set(const std::size_t bit) {
+                const std::size_t w = bit / word_bits;
+                if (w < inline_words) {
+                    words[w] |= mask_of(bit);
+                } else {
+                    if (spill.size() <= w - inline_words) spill.resize(w - inline_words + 1, 0);
+                    spill[w - inline_words] |= mask_of(bit);
+                }
+            }
+
+            inline void reset(const std::size_t bit) noexcept {
+                const std::size_t w = bit / word_bits;
+                if (w < inline_words) {
+                    words[w] &= ~mask_of(bit);
+                } else if (w - inline_words < spill.size()) {
+                    spill[w - inline_words] &= ~mask_of(bit);
+                }
+            }
+
+            inline void reset() noexcept {
+                words.fill(0);
+                spill.clear();
+            }
+
+            inline bool test(const std::size_t bit) const noexcept {
+                return (word(bit / word_bits) & mask_of(bit)) != 0;
+            }
+
+            inline bool none() const noexcept {
+                for (const std::uint64_t &w : words) if (w) return false;
+                for (const std::uint64_t &w : spill) if (w) return false;
+                return true;
+            }
+
+            inline bool any() const noexcept { return !none(); }
+
+            /*
+             * True if every bit set in query is also set here.
+             */
+            inline bool contains(const component_mask_t &query) const noexcept {
+                for (std::size_t i=0; i<inline_words; ++i) {
+                    if ((words[i] & query.words[i]) != query.words[i]) return false;
+                }
+                for (std::size_t i=0; i<query.spill.size(); ++i) {
+                    if ((word(inline_words + i) & query.spill[i]) != query.spill[i]) return false;
+                }
+                return true;
+            }
+
+            /*
+             * Raw word access, for binary snapshots. word_count covers every word that may be non-zero.
+             */
+            inline std::size_t word_count() const noexcept { return inline_words + spill.size(); }
+
+            inline std::uint64_t word(const std::size_t w) const noexcept {
+                if (w < inline_words) return words[w];
+                return w - inline_words < spill.size() ? spill[w - inline_words] : 0;
+            }
+
+            inline void set_word(const std::size_t w, const std::uint64_t value) {
+                if (w < inline_words) {
+                    words[w] = value;
+                } else if (value != 0 || w - inline_words < spill.size()) {
+                    if (spill.size() <= w - inline_words) spill.resize(w - inline_words + 1, 0);
+                    spill[w - inline_words] = value;
+                }
+            }
+
+            template<class Archive>
+            void save(Archive & archive) const
+            {
+                std::bitset<MAX_COMPONENTS> bits;
+                for (std::size_t w=0; w<word_count(); ++w) {
+                    const std::uint64_t value = word(w);
+                    for (std::size_t b=0; b<word_bits; ++b) {
+                        if (!(value & mask_of(b))) continue;
+                        const std::size_t bit = (w * word_bits) + b;
+                        if (bit >= MAX_COMPONENTS) throw std::runtime_error("Too many component types for ecs_save; use ecs_save_snapshot");
+                        bits.set(bit);
+                    }
+                }
+                archive( bits );
+            }
+
+            template<class Archive>
+            void load(Archive & archive)
+            {
+                std::bitset<MAX_COMPONENTS> bits;
+                archive( bits );
+                reset();
+                for (std::size_t bit=0; bit<MAX_COMPONENTS; ++bit) {
+                    if (bits.test(bit)) set(bit);
+                }
+            }
+
+        private:
+            std::array<std::uint64_t, inline_words> words{};
+            std::vector<std::uint64_t> spill;
+
+            static constexpr std::uint64_t mask_of(const std::size_t bit) noexcept {
+                return std::uint64_t(1) << (bit % word_bits);
+            }
+        };
+
+        /*
+         * Binary snapshots (see ecs::ecs_save_snapshot) are a header followed by sections: one for the entities,
+         * and one per component store. Each section is a fixed-size header followed by columns (raw arrays),
+         * and everything starts on a snapshot_alignment boundary - so a memory-mapped snapshot can be read
+         * in place.
+         */
+        constexpr std::size_t snapshot_alignment = 64;
+
+        enum snapshot_kind_t : std::uint32_t { SNAPSHOT_ENTITIES = 1, SNAPSHOT_COMPONENTS = 2, SNAPSHOT_ENTITY_DELTA = 3, SNAPSHOT_COMPONENT_DELTA = 4 };
+
+        /*
+         * Trivially copyable components are stored as a raw array of component_t; anything else is
+         * serialized with cereal into a single byte column.
+         */
+        enum snapshot_layout_t : std::uint32_t { SNAPSHOT_RAW = 1, SNAPSHOT_CEREAL = 2 };
+
+        struct snapshot_section_t {
+            std::uint32_t kind = 0;
+            std::uint32_t layout = 0;
+            std::uint64_t family_id = 0;
+            std::uint64_t element_size = 0;
+            std::uint64_t counts[3] = {0, 0, 0};
+        };
+
+        class snapshot_writer {
+        public:
+            explicit snapshot_writer(std::ostream &stream) : out(stream) {}
+
+            inline void write(const void * data, const std::size_t bytes) {
+                out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+                offset += bytes;
+            }
+
+            /* Pads the output to the next snapshot_alignment boundary */
+            inline void align() {
+                static const char zeros[snapshot_alignment] = {};
+                const std::size_t remainder = offset % snapshot_alignment;
+                if (remainder) write(zeros, snapshot_alignment - remainder);
+            }
+
+            template <class T>
+            inline void column(const T * data, const std::size_t count) {
+                if (count) write(data, count * sizeof(T));
+                align();
+            }
+
+            inline void section(const snapshot_section_t &header) {
+                write(&header, sizeof(header));
+                align();
+            }
+
+        private:
+            std::ostream &out;
+            std::size_t offset = 0;
+        };
+
+        class snapshot_reader {
+        public:
+            snapshot_reader(const char * data, const std::size_t size) : base(data), length(size) {}
+
+            /*
+             * Returns a pointer to the next count items of T in the snapshot, and skips past them. Throws if the
+             * snapshot is truncated.
+             */
+            template <class T>
+            inline const T * column(const std::size_t count) {
+                if (count > (length - offset) / sizeof(T)) throw std::runtime_error("Snapshot is truncated");
+                const T * result = reinterpret_cast<const T *>(base + offset);
+                offset += count * sizeof(T);
+                offset += (snapshot_alignment - offset % snapshot_alignment) % snapshot_alignment;
+                if (offset > length) offset = length;
+                return result;
+            }
+
+            inline bool done() const noexcept { return offset >= length; }
+
+        private:
+            const char * base;
+            std::size_t length;
+            std::size_t offset = 0;
+        };
+
+        /*
+         * Snapshots hold non-trivially-copyable components as cereal binary; this is only possible for types
+         * cereal knows how to serialize.
+         */
+        template <class C>
+        struct snapshot_serializable : std::integral_constant<bool,
+                cereal::traits::is_output_serializable<C, cereal::BinaryOutputArchive>::value &&
+                cereal::traits::is_input_serializable<C, cereal::BinaryInputArchive>::value> {};
+
+        /*
+         * Creates an empty store of the right type for each component family; populated as families are
+         * allocated, so that loaders can re-create stores that haven't been assigned to yet.
+         */
+        struct base_component_store;
+        template<class C> struct component_store_t;
+        using component_store_factory_t = std::unique_ptr<base_component_store> (*)();
+
+        inline std::vector<component_store_factory_t> &component_store_factories() {
+            static std::vector<component_store_factory_t> factories;
+            return factories;
+        }
+
+        template <class C>
+        inline std::unique_ptr<base_component_store> make_component_store();
+
         /*
          * Base type for component handles. Exists so that we can have a vector of pointers to
          * derived classes. entity_id is included to allow a quick reference without a static cast.
@@ -70,6 +326,9 @@ namespace rltk {
             std::size_t entity_id;
             bool deleted = false;
 
+            // Set when the component may have changed since the last checkpoint (only while tracking changes)
+            bool dirty = false;
+
             template<class Archive>
             void serialize(Archive & archive)
             {
@@ -151,11 +410,28 @@ namespace rltk {
                 archive( cereal::base_class<base_component_t>(this), family_id, data ); // serialize things by passing them to the archive
             }
 
+            /*
+             * The family_id for components of type C, available without constructing a component.
+             */
+            static inline std::size_t type_family() {
+                static std::size_t family_id_tmp = register_family();
+                return family_id_tmp;
+            }
+
             inline void family() {
-                static std::size_t family_id_tmp = base_component_t::type_counter++;
-                family_id = family_id_tmp;
+                family_id = type_family();
             }
 
+        private:
+            static inline std::size_t register_family() {
+                const std::size_t id = base_component_t::type_counter++;
+                auto &factories = component_store_factories();
+                if (factories.size() <= id) factories.resize(id+1, nullptr);
+                factories[id] = &make_component_store<component_t<C>>;
+                return id;
+            }
+
+        public:
             inline std::string xml_identity() {
                 std::string id;
                 _calc_xml_identity<C>().test(data, id);
@@ -172,10 +448,32 @@ namespace rltk {
          * Base class for the component store. Concrete component stores derive from this.
          */
         struct base_component_store {
+            /*
+             * Number of components flagged as deleted but not yet removed; garbage collection skips stores where
+             * this is zero.
+             */
+            std::size_t deleted_count = 0;
+
+            /*
+             * Change tracking, for delta saves (see ecs::ecs_track_changes). While enabled, components are flagged
+             * dirty when assigned or handed out for modification, and the IDs of entities whose component was
+             * removed are recorded.
+             */
+            bool track_changes = false;
+            std::vector<std::size_t> removed_ids;
+
+            virtual ~base_component_store() {}
             virtual void erase_by_entity_id(ecs &ECS, const std::size_t &id)=0;
             virtual void really_delete()=0;
             virtual void save(xml_node * xml)=0;
+            virtual void save(xml_stream_writer &out)=0;
             virtual std::size_t size()=0;
+            virtual void save_snapshot(snapshot_writer &out, const std::size_t family_id)=0;
+            virtual void load_snapshot(snapshot_reader &in, const snapshot_section_t &header)=0;
+            virtual void save_delta(snapshot_writer &out, const std::size_t family_id)=0;
+            virtual void load_delta(snapshot_reader &in, const snapshot_section_t &header, std::vector<std::size_t> &removed,
+                                    std::vector<std::size_t> &added)=0;
+            virtual void clear_changes()=0;
 
             template<class Archive>
             void serialize(Archive & archive)
@@ -193,21 +491,129 @@ namespace rltk {
          */
         template<class C>
         struct component_store_t : public base_component_store {
+            using component_type = C;
             std::vector<C> components;
 
-            virtual void erase_by_entity_id(ecs &ECS, const std::size_t &id) override final {
-                for (auto &item : components) {
-                    if (item.entity_id == id) {
-                        item.deleted=true;
-                        impl::unset_component_mask(ECS, id, item.family_id);
-                    }
+            /*
+             * Sparse index from entity id to the entity's slot in the dense components vector. Unused slots
+             * hold npos. This makes finding an entity's component O(1), while iteration still walks the
+             * contiguous components vector.
+             */
+            std::vector<std::size_t> entity_index;
+            static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+            /*
+             * Dense slots of components flagged as deleted, so that really_delete only has to visit them.
+             */
+            std::vector<std::size_t> deleted_slots;
+
+            /*
+             * By default, removal moves the last component into the freed slot - which is O(1) per
+             * removal, but changes iteration order. Stores with stable_order set instead close the gaps
+             * by shifting later components down, preserving the order in which they were added.
+             */
+            bool stable_order = false;
+
+            inline std::size_t index_of(const std::size_t &id) const noexcept {
+                return id < entity_index.size() ? entity_index[id] : npos;
+            }
+
+            inline void set_index(const std::size_t &id, const std::size_t &idx) {
+                if (id >= entity_index.size()) entity_index.resize(id+1, npos);
+                entity_index[id] = idx;
+            }
+
+            /*
+             * Finds the live component belonging to an entity, or nullptr if it doesn't have one.
+             */
+            inline C * find(const std::size_t &id) noexcept {
+                const std::size_t idx = index_of(id);
+                if (idx == npos) return nullptr;
+                return &components[idx];
+            }
+
+            /*
+             * Adds a component; if the entity already has a live component of this type, it is replaced
+             * in-place.
+             */
+            inline void add(C component) {
+                component.dirty = track_changes;
+                const std::size_t idx = index_of(component.entity_id);
+                if (idx != npos) {
+                    components[idx] = component;
+                } else {
+                    set_index(component.entity_id, components.size());
+                    components.push_back(component);
+                }
+            }
+
+            /*
+             * Marks an entity's component as deleted, and removes it from the index. It stays in the
+             * dense vector until really_delete is called.
+             */
+            inline C * mark_deleted(const std::size_t &id) noexcept {
+                C * item = find(id);
+                if (item) {
+                    item->deleted = true;
+                    if (track_changes) removed_ids.push_back(id);
+                    deleted_slots.push_back(entity_index[id]);
+                    entity_index[id] = npos;
+                    ++deleted_count;
+                }
+                return item;
+            }
+
+            /*
+             * Finds a live component for modification, flagging it dirty if changes are being tracked.
+             */
+            inline C * touch(const std::size_t &id) noexcept {
+                C * item = find(id);
+                if (item && track_changes) item->dirty = true;
+                return item;
+            }
+
+            /*
+             * Rebuilds the sparse index from the dense vector. Used after compaction and loading.
+             */
+            inline void rebuild_index() {
+                std::fill(entity_index.begin(), entity_index.end(), npos);
+                for (std::size_t i=0; i<components.size(); ++i) {
+                    if (!components[i].deleted) set_index(components[i].entity_id, i);
                 }
             }
 
+            virtual void erase_by_entity_id(ecs &ECS, const std::size_t &id) override final {
+                C * item = mark_deleted(id);
+                if (item) impl::unset_component_mask(ECS, id, item->family_id);
+            }
+
             virtual void really_delete() override final {
-                components.erase(std::remove_if(components.begin(), components.end(),
-                                                [] (auto x) { return x.deleted; }),
-                                 components.end());
+                if (deleted_slots.empty()) return;
+                std::sort(deleted_slots.begin(), deleted_slots.end());
+
+                if (stable_order) {
+                    // Everything before the first deleted slot stays where it is.
+                    const std::size_t first = deleted_slots.front();
+                    auto new_end = std::remove_if(components.begin() + first, components.end(),
+                                                    [] (const C &x) { return x.deleted; });
+                    components.erase(new_end, components.end());
+                    for (std::size_t i=first; i<components.size(); ++i) {
+                        entity_index[components[i].entity_id] = i;
+                    }
+                } else {
+                    // Working from the back guarantees the last component is live whenever it is moved.
+                    for (auto it = deleted_slots.rbegin(); it != deleted_slots.rend(); ++it) {
+                        const std::size_t last = components.size() - 1;
+                        if (*it != last) {
+                            components[*it] = std::move(components[last]);
+                            entity_index[components[*it].entity_id] = *it;
+                        }
+                        components.pop_back();
+                    }
+                }
+
+                deleted_slots.clear();
+                deleted_count = 0;
             }
 
             virtual void save(xml_node * xml) override final {
@@ -218,18 +624,231 @@ namespace rltk {
                 }
             }
 
+            /*
+             * As save(xml_node *), but each component is written out as soon as it is built.
+             */
+            virtual void save(xml_stream_writer &out) override final {
+                for (auto &item : components) {
+                    xml_node body(item.xml_identity());
+                    item.to_xml(&body);
+                    body.add_value("entity_id", rltk::serial::to_string(item.entity_id));
+                    out.write(body);
+                }
+            }
+
             virtual std::size_t size() override final {
                 return components.size();
             }
 
+            virtual void save_snapshot(snapshot_writer &out, const std::size_t family_id) override final {
+                save_snapshot(out, family_id, std::is_trivially_copyable<C>());
+            }
+
+            virtual void load_snapshot(snapshot_reader &in, const snapshot_section_t &header) override final {
+                if (header.layout == SNAPSHOT_RAW) {
+                    if (header.element_size != sizeof(C) || !std::is_trivially_copyable<C>::value) {
+                        throw std::runtime_error("Snapshot component layout does not match this program");
+                    }
+                    const C * first = in.column<C>(header.counts[0]);
+                    components.assign(first, first + header.counts[0]);
+                    const std::size_t * index = in.column<std::size_t>(header.counts[1]);
+                    entity_index.assign(index, index + header.counts[1]);
+                    const std::size_t * deleted = in.column<std::size_t>(header.counts[2]);
+                    deleted_slots.assign(deleted, deleted + header.counts[2]);
+                    deleted_count = deleted_slots.size();
+                } else if (header.layout == SNAPSHOT_CEREAL) {
+                    const char * bytes = in.column<char>(header.counts[0]);
+                    load_serialized_store(bytes, header.counts[0]);
+                } else {
+                    throw std::runtime_error("Unknown snapshot component layout");
+                }
+            }
+
+            /*
+             * Writes the entities whose component was removed, then the live components flagged dirty - and
+             * clears the flags.
+             */
+            virtual void save_delta(snapshot_writer &out, const std::size_t family_id) override final {
+                std::vector<C> changed;
+                for (C &component : components) {
+                    if (component.dirty && !component.deleted) {
+                        component.dirty = false;
+                        changed.push_back(component);
+                    }
+                }
+
+                snapshot_section_t header;
+                header.kind = SNAPSHOT_COMPONENT_DELTA;
+                header.family_id = family_id;
+                header.counts[0] = removed_ids.size();
+                out.section(header);
+                out.column(removed_ids.data(), removed_ids.size());
+                removed_ids.clear();
+                write_components(out, changed, std::is_trivially_copyable<C>());
+            }
+
+            /*
+             * Applies a delta written by save_delta: removes components, then adds or replaces the changed ones.
+             * The IDs of affected entities are appended to removed and added, so that the caller can update
+             * their masks.
+             */
+            virtual void load_delta(snapshot_reader &in, const snapshot_section_t &header, std::vector<std::size_t> &removed,
+                                    std::vector<std::size_t> &added) override final {
+                const std::size_t * ids = in.column<std::size_t>(header.counts[0]);
+                for (std::size_t i=0; i<header.counts[0]; ++i) {
+                    if (mark_deleted(ids[i])) removed.push_back(ids[i]);
+                }
+
+                std::vector<C> changed = read_components(in);
+                for (C &component : changed) {
+                    added.push_back(component.entity_id);
+                    add(component);
+                }
+            }
+
+            virtual void clear_changes() override final {
+                for (C &component : components) component.dirty = false;
+                removed_ids.clear();
+            }
+
             template<class Archive>
             void serialize(Archive & archive)
             {
                 archive( cereal::base_class<base_component_store>(this), components ); // serialize things by passing them to the archive
+                if (Archive::is_loading::value) {
+                    deleted_slots.clear();
+                    for (std::size_t i=0; i<components.size(); ++i) {
+                        if (components[i].deleted) deleted_slots.push_back(i);
+                    }
+                    deleted_count = deleted_slots.size();
+                    rebuild_index();
+                }
+            }
+
+        private:
+            /*
+             * A column of components, preceded by a section header giving its layout and size. Used by deltas,
+             * where there is no index to go with it.
+             */
+            inline void write_components(snapshot_writer &out, const std::vector<C> &items, std::true_type) {
+                snapshot_section_t header;
+                header.layout = SNAPSHOT_RAW;
+                header.element_size = sizeof(C);
+                header.counts[0] = items.size();
+                out.section(header);
+                out.column(items.data(), items.size());
             }
 
+            inline void write_components(snapshot_writer &out, const std::vector<C> &items, std::false_type) {
+                const std::string bytes = save_serialized(items, snapshot_serializable<decltype(C::data)>());
+                snapshot_section_t header;
+                header.layout = SNAPSHOT_CEREAL;
+                header.counts[0] = bytes.size();
+                out.section(header);
+                out.column(bytes.data(), bytes.size());
+            }
+
+            inline std::vector<C> read_components(snapshot_reader &in) {
+                const snapshot_section_t header = *in.column<snapshot_section_t>(1);
+                std::vector<C> result;
+                if (header.layout == SNAPSHOT_RAW) {
+                    if (header.element_size != sizeof(C) || !std::is_trivially_copyable<C>::value) {
+                        throw std::runtime_error("Snapshot component layout does not match this program");
+                    }
+                    const C * first = in.column<C>(header.counts[0]);
+                    result.assign(first, first + header.counts[0]);
+                } else if (header.layout == SNAPSHOT_CEREAL) {
+                    const char * bytes = in.column<char>(header.counts[0]);
+                    load_serialized(result, bytes, header.counts[0], snapshot_serializable<decltype(C::data)>());
+                } else {
+                    throw std::runtime_error("Unknown snapshot component layout");
+                }
+                return result;
+            }
+
+            inline void save_snapshot(snapshot_writer &out, const std::size_t family_id, std::true_type) {
+                snapshot_section_t header;
+                header.kind = SNAPSHOT_COMPONENTS;
+                header.layout = SNAPSHOT_RAW;
+                header.family_id = family_id;
+                header.element_size = sizeof(C);
+                header.counts[0] = components.size();
+                header.counts[1] = entity_index.size();
+                header.counts[2] = deleted_slots.size();
+                out.section(header);
+                out.column(components.data(), components.size());
+                out.column(entity_index.data(), entity_index.size());
+                out.column(deleted_slots.data(), deleted_slots.size());
+            }
+
+            inline void save_snapshot(snapshot_writer &out, const std::size_t family_id, std::false_type) {
+                const std::string bytes = save_serialized(components, snapshot_serializable<decltype(C::data)>());
+                snapshot_section_t header;
+                header.kind = SNAPSHOT_COMPONENTS;
+                header.layout = SNAPSHOT_CEREAL;
+                header.family_id = family_id;
+                header.counts[0] = bytes.size();
+                out.section(header);
+                out.column(bytes.data(), bytes.size());
+            }
+
+            inline std::string save_serialized(const std::vector<C> &items, std::true_type) {
+                std::ostringstream ss;
+                {
+                    cereal::BinaryOutputArchive archive(ss);
+                    archive( items );
+                }
+                return ss.str();
+            }
+
+            inline std::string save_serialized(const std::vector<C> &, std::false_type) {
+                throw std::runtime_error("Component type is neither trivially copyable nor serializable, so cannot be snapshotted");
+            }
+
+            inline void load_serialized(std::vector<C> &items, const char * bytes, const std::size_t size, std::true_type) {
+                std::istringstream ss(std::string(bytes, size));
+                cereal::BinaryInputArchive archive(ss);
+                archive( items );
+            }
+
+            inline void load_serialized(std::vector<C> &, const char *, const std::size_t, std::false_type) {
+                throw std::runtime_error("Component type is not serializable, so cannot be loaded from a snapshot");
+            }
+
+            inline void load_serialized_store(const char * bytes, const std::size_t size) {
+                load_serialized(components, bytes, size, snapshot_serializable<decltype(C::data)>());
+                deleted_slots.clear();
+                for (std::size_t i=0; i<components.size(); ++i) {
+                    if (components[i].deleted) deleted_slots.push_back(i);
+                }
+                deleted_count = deleted_slots.size();
+                rebuild_index();
+            }
         };
 
+        template<class C>
+        constexpr std::size_t component_store_t<C>::npos;
+
+        template <class C>
+        inline std::unique_ptr<base_component_store> make_component_store() {
+            return std::make_unique<component_store_t<C>>();
+        }
+
+        /*
+         * The component mask an entity must contain to have all of the component types Cs (given as their
+         * component_t handles). Built once for each combination of types.
+         */
+        template <class... Cs>
+        inline const component_mask_t &query_mask() {
+            static const component_mask_t mask = [] () {
+                component_mask_t result;
+                using expander = int[];
+                (void)expander{ 0, (result.set(Cs::type_family()), 0)... };
+                return result;
+            }();
+            return mask;
+        }
+
         /*
          * Handle class for messages
          */
@@ -246,9 +865,16 @@ namespace rltk {
             std::size_t family_id;
             C data;
 
-            inline void family() {
+            /*
+             * The family_id for messages of type C, available without constructing a message.
+             */
+            static inline std::size_t type_family() noexcept {
                 static std::size_t family_id_tmp = base_message_t::type_counter++;
-                family_id = family_id_tmp;
+                return family_id_tmp;
+            }
+
+            inline void family() {
+                family_id = type_family();
             }
         };
 
@@ -256,11 +882,13 @@ namespace rltk {
          * Base class for storing subscriptions to messages
          */
         struct subscription_base_t {
+            virtual ~subscription_base_t() {}
             virtual void deliver_messages()=0;
         };
 
         /* Base class for subscription mailboxes */
         struct subscription_mailbox_t {
+            virtual ~subscription_mailbox_t() {}
         };
 
         /* Implementation class for mailbox subscriptions; stores a queue */
@@ -269,35 +897,149 @@ namespace rltk {
             std::queue<C> messages;
         };
 
+        /* Unique IDs for subscription holders, so that threads can cache their staging buffer safely */
+        inline std::uint64_t next_subscription_holder_id() noexcept {
+            static std::atomic<std::uint64_t> counter{1};
+            return counter++;
+        }
+
         /*
          * Class that holds subscriptions, and determines delivery mechanism.
+         *
+         * Deferred messages are staged in a buffer per producing thread, so that threads emitting the same message
+         * type don't contend with one another; each buffer's lock is only ever shared with the delivering thread.
+         * Delivery moves the staged messages out, and runs the subscribers without holding any lock.
          */
         template <class C>
         struct subscription_holder_t : subscription_base_t {
-            std::queue<C> delivery_queue;
-            std::mutex delivery_mutex;
-            std::vector<std::tuple<bool,std::function<void(C& message)>,base_system *>> subscriptions;
-
-            virtual void deliver_messages() override {
-                std::lock_guard<std::mutex> guard(delivery_mutex);
-                while (!delivery_queue.empty()) {
-                    C message = delivery_queue.front();
-                    delivery_queue.pop();
-                    message_t<C> handle(message);
-
-                    for (auto &func : subscriptions) {
-                        if (std::get<0>(func) && std::get<1>(func)) {
-                            std::get<1>(func)(message);
+            struct thread_queue_t {
+                std::thread::id owner;
+                std::mutex lock;
+                std::vector<C> messages;
+            };
+
+            const std::uint64_t holder_id = next_subscription_holder_id();
+            std::mutex registry_lock;
+            std::vector<std::unique_ptr<thread_queue_t>> thread_queues;
+            /*
+             * A subscriber is either a callback, or a system's mailbox; mailboxes are resolved when subscribing,
+             * so delivery is just a walk over this list.
+             */
+            struct subscriber_t {
+                std::function<void(C& message)> callback;
+                std::queue<C> * mailbox = nullptr;
+            };
+            std::vector<subscriber_t> subscriptions;
+
+            /*
+             * Hands a message to every subscriber. If owned, the last subscriber may take it by move.
+             */
+            inline void dispatch(C &message, const bool owned) {
+                const std::size_t n = subscriptions.size();
+                for (std::size_t i=0; i<n; ++i) {
+                    subscriber_t &sub = subscriptions[i];
+                    if (sub.mailbox) {
+                        if (owned && i+1 == n) {
+                            sub.mailbox->push(std::move(message));
                         } else {
-                            // It is destined for the system's mailbox queue.
-                            auto finder = std::get<2>(func)->mailboxes.find(handle.family_id);
-                            if (finder != std::get<2>(func)->mailboxes.end()) {
-                                static_cast<mailbox_t<C> *>(finder->second.get())->messages.push(message);
-                            }
+                            sub.mailbox->push(message);
                         }
+                    } else if (sub.callback) {
+                        sub.callback(message);
+                    }
+                }
+            }
+
+            /* Stages a message for delivery on the next deliver_messages call. Thread-safe. */
+            inline void enqueue(C &&message) {
+                thread_queue_t * queue = local_queue();
+                std::lock_guard<std::mutex> guard(queue->lock);
+                queue->messages.emplace_back(std::move(message));
+            }
+
+            virtual void deliver_messages() override {
+                std::vector<C> batch;
+                // Subscribers may defer more messages of this type; keep going until they stop.
+                while (collect(batch)) {
+                    for (C &message : batch) {
+                        dispatch(message, true);
                     }
+                    batch.clear();
                 }
             }
+
+        private:
+            /* Finds (or creates) the calling thread's staging buffer; the last one used is cached per thread. */
+            inline thread_queue_t * local_queue() {
+                static thread_local std::uint64_t cached_holder = 0;
+                static thread_local thread_queue_t * cached_queue = nullptr;
+                if (cached_holder == holder_id) return cached_queue;
+
+                const std::thread::id me = std::this_thread::get_id();
+                std::lock_guard<std::mutex> guard(registry_lock);
+                thread_queue_t * result = nullptr;
+                for (auto &queue : thread_queues) {
+                    if (queue->owner == me) result = queue.get();
+                }
+                if (!result) {
+                    thread_queues.push_back(std::make_unique<thread_queue_t>());
+                    result = thread_queues.back().get();
+                    result->owner = me;
+                }
+                cached_holder = holder_id;
+                cached_queue = result;
+                return result;
+            }
+
+            /* Moves every staged message into batch, in per-thread emission order. Returns false if there were none. */
+            inline bool collect(std::vector<C> &batch) {
+                std::lock_guard<std::mutex> guard(registry_lock);
+                for (auto &queue : thread_queues) {
+                    std::lock_guard<std::mutex> queue_guard(queue->lock);
+                    std::move(queue->messages.begin(), queue->messages.end(), std::back_inserter(batch));
+                    queue->messages.clear();
+                }
+                return !batch.empty();
+            }
+        };
+
+        /*
+         * Deferred messages emitted by a system running under ecs_tick_parallel are staged here, and delivered
+         * (ordered by message type, then emission order) when the system finishes.
+         */
+        struct deferred_staging_t {
+            std::mutex lock;
+            std::vector<std::pair<std::size_t, std::function<void()>>> messages;
+        };
+
+        // The staging area for the system running on this thread, if any.
+        extern thread_local deferred_staging_t * current_staging;
+
+        /*
+         * The component and message families a system has declared that it reads and writes.
+         */
+        struct system_access_t {
+            bool declared = false;
+            std::vector<std::size_t> component_reads;
+            std::vector<std::size_t> component_writes;
+            std::vector<std::size_t> message_reads;
+            std::vector<std::size_t> message_writes;
+
+            /* True if two systems may not run at the same time */
+            inline bool conflicts_with(const system_access_t &other) const noexcept {
+                if (!declared || !other.declared) return true;
+                return overlaps(component_writes, other.component_writes) || overlaps(component_writes, other.component_reads) ||
+                       overlaps(component_reads, other.component_writes) || overlaps(message_writes, other.message_writes) ||
+                       overlaps(message_writes, other.message_reads) || overlaps(message_reads, other.message_writes);
+            }
+
+        private:
+            static inline bool overlaps(const std::vector<std::size_t> &a, const std::vector<std::size_t> &b) noexcept {
+                for (const std::size_t &x : a) {
+                    if (std::find(b.begin(), b.end(), x) != b.end()) return true;
+                }
+                return false;
+            }
         };
 
     } // End impl namespace
@@ -346,7 +1088,7 @@ namespace rltk {
          * A bitset storing whether or not an entity has each component type. These are set with the family_id
          * determined in the component_t system above.
          */
-        std::bitset<impl::MAX_COMPONENTS> component_mask;
+        impl::component_mask_t component_mask;
 
         /*
          * Assign a component to this entity. Determines the family_id of the component type, sets the bitmask to
@@ -385,15 +1127,215 @@ namespace rltk {
         }
     };
 
+    /*
+     * A generational handle to an entity: the slot it occupies in the entity table, and the version of that
+     * slot when the handle was taken. Slots are recycled after garbage collection, so a handle whose version
+     * no longer matches refers to an entity that has gone away. Use ecs::handle and ecs::entity(handle).
+     */
+    struct entity_handle_t {
+        std::size_t slot = 0;
+        std::uint32_t version = 0;
+    };
+
+    namespace impl {
+
+        template <class C>
+        inline component_store_t<component_t<C>> * store_for(ecs &ECS);
+
+        /*
+         * Entity storage. Entities live in fixed-size pages of slots, so an entity_t never moves once created
+         * (pointers survive garbage collection and growth), and iteration walks memory linearly. Freed slots
+         * go onto a free list for re-use; each slot has a version number (odd while occupied) that is bumped
+         * whenever it is freed or re-used, so that handles can detect staleness. Entity IDs are never re-used,
+         * and map to slots through a sparse index.
+         */
+        struct entity_table_t {
+            static constexpr std::size_t page_size = 4096;
+            static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+            inline entity_t &at(const std::size_t &slot) noexcept {
+                return pages[slot / page_size][slot % page_size];
+            }
+
+            inline bool occupied(const std::size_t &slot) const noexcept {
+                return (versions[slot] & 1) != 0;
+            }
+
+            inline std::size_t slot_of(const std::size_t &id) const noexcept {
+                return id < id_to_slot.size() ? id_to_slot[id] : npos;
+            }
+
+            inline std::uint32_t version(const std::size_t &slot) const noexcept {
+                return versions[slot];
+            }
+
+            /*
+             * Resolves a handle, returning nullptr if the slot has been freed or re-used since it was taken.
+             */
+            inline entity_t * find(const entity_handle_t &h) noexcept {
+                if (h.slot >= versions.size() || versions[h.slot] != h.version || !occupied(h.slot)) return nullptr;
+                return &at(h.slot);
+            }
+
+            /*
+             * Finds an entity by ID, including ones marked as deleted but not yet collected.
+             */
+            inline entity_t * find(const std::size_t &id) noexcept {
+                const std::size_t slot = slot_of(id);
+                if (slot == npos) return nullptr;
+                return &at(slot);
+            }
+
+            /*
+             * Stores a copy of an entity in a free slot, and returns a pointer to it. The caller is responsible
+             * for ensuring that the ID isn't already present.
+             */
+            inline entity_t * insert(const entity_t &e) {
+                std::size_t slot;
+                if (!free_slots.empty()) {
+                    slot = free_slots.back();
+                    free_slots.pop_back();
+                    at(slot) = e;
+                    ++versions[slot];
+                } else {
+                    slot = versions.size();
+                    if (pages.empty() || pages.back().size() == page_size) {
+                        pages.emplace_back();
+                        pages.back().reserve(page_size);
+                    }
+                    pages.back().push_back(e);
+                    versions.push_back(1);
+                }
+                if (e.id >= id_to_slot.size()) id_to_slot.resize(e.id+1, npos);
+                id_to_slot[e.id] = slot;
+                ++count;
+                return &at(slot);
+            }
+
+            /*
+             * Frees an entity's slot. Any remaining pointers to it will see an entity flagged as deleted
+             * (until the slot is re-used), and handles to it will no longer resolve.
+             */
+            inline void erase(const std::size_t &id) noexcept {
+                const std::size_t slot = slot_of(id);
+                if (slot == npos) return;
+                entity_t &e = at(slot);
+                e.deleted = true;
+                e.component_mask.reset();
+                ++versions[slot];
+                id_to_slot[id] = npos;
+                free_slots.push_back(slot);
+                --count;
+            }
+
+            /*
+             * Frees every slot. Pages are retained, so existing pointers remain valid memory.
+             */
+            inline void clear() noexcept {
+                for (std::size_t slot=0; slot<versions.size(); ++slot) {
+                    if (occupied(slot)) erase(at(slot).id);
+                }
+            }
+
+            /*
+             * Calls func on every stored entity (including those marked as deleted but not yet collected),
+             * in slot order.
+             */
+            template <typename F>
+            inline void for_each(F &&func) {
+                for (std::size_t slot=0; slot<versions.size(); ++slot) {
+                    if (occupied(slot)) func(at(slot));
+                }
+            }
+
+            inline std::size_t size() const noexcept { return count; }
+
+            /*
+             * Cereal support. The on-disk format matches the std::unordered_map<std::size_t, entity_t> that
+             * used to hold entities, so existing save files still load.
+             */
+            template<class Archive>
+            void save(Archive & archive) const
+            {
+                archive( cereal::make_size_tag(static_cast<cereal::size_type>(count)) );
+                for (std::size_t slot=0; slot<versions.size(); ++slot) {
+                    if (occupied(slot)) {
+                        const entity_t &e = pages[slot / page_size][slot % page_size];
+                        archive( cereal::make_map_item(e.id, e) );
+                    }
+                }
+            }
+
+            template<class Archive>
+            void load(Archive & archive)
+            {
+                cereal::size_type n;
+                archive( cereal::make_size_tag(n) );
+                clear();
+                for (cereal::size_type i=0; i<n; ++i) {
+                    std::size_t id;
+                    entity_t e(0);
+                    archive( cereal::make_map_item(id, e) );
+                    insert(e);
+                }
+            }
+
+        private:
+            std::vector<std::vector<entity_t>> pages;
+            std::vector<std::uint32_t> versions;
+            std::vector<std::size_t> free_slots;
+            std::vector<std::size_t> id_to_slot;
+            std::size_t count = 0;
+        };
+
+    } // End impl namespace
+
     /*
      * Systems should inherit from this class.
      */
     struct base_system {
+        virtual ~base_system() {}
         virtual void configure() {}
         virtual void update(const double duration_ms)=0;
         std::string system_name = "Unnamed System";
         std::unordered_map<std::size_t, std::unique_ptr<impl::subscription_mailbox_t>> mailboxes;
 
+        /*
+         * Access declarations, used by ecs_tick_parallel to decide which systems may run at the same time. Call
+         * them from the constructor or configure(). A system that declares nothing is assumed to touch everything,
+         * and always runs on its own; systems that create or delete entities must not declare access.
+         * Subscribing to a message counts as reading it, and emitting one as writing it.
+         */
+        impl::system_access_t access;
+
+        template<class... Cs>
+        void reads() {
+            access.declared = true;
+            std::vector<std::size_t> ids{ impl::component_t<Cs>::type_family()... };
+            access.component_reads.insert(access.component_reads.end(), ids.begin(), ids.end());
+        }
+
+        template<class... Cs>
+        void writes() {
+            access.declared = true;
+            std::vector<std::size_t> ids{ impl::component_t<Cs>::type_family()... };
+            access.component_writes.insert(access.component_writes.end(), ids.begin(), ids.end());
+        }
+
+        template<class... MSGs>
+        void reads_messages() {
+            access.declared = true;
+            std::vector<std::size_t> ids{ impl::message_t<MSGs>::type_family()... };
+            access.message_reads.insert(access.message_reads.end(), ids.begin(), ids.end());
+        }
+
+        template<class... MSGs>
+        void writes_messages() {
+            access.declared = true;
+            std::vector<std::size_t> ids{ impl::message_t<MSGs>::type_family()... };
+            access.message_writes.insert(access.message_writes.end(), ids.begin(), ids.end());
+        }
+
         template<class MSG>
         void subscribe(ecs &ECS, std::function<void(MSG &message)> destination) {
             impl::subscribe<MSG>(ECS, *this, destination);
@@ -416,8 +1358,7 @@ namespace rltk {
 
         template<class MSG>
         std::queue<MSG> * mbox() {
-            impl::message_t<MSG> handle(MSG{});
-            auto finder = mailboxes.find(handle.family_id);
+            auto finder = mailboxes.find(impl::message_t<MSG>::type_family());
             if (finder != mailboxes.end()) {
                 return &static_cast<impl::mailbox_t<MSG> *>(finder->second.get())->messages;
             } else {
@@ -429,7 +1370,7 @@ namespace rltk {
         void each_mbox(const std::function<void(const MSG&)> &func) {
             std::queue<MSG> * mailbox = mbox<MSG>();
             while (!mailbox->empty()) {
-                MSG msg = mailbox->front();
+                MSG msg = std::move(mailbox->front());
                 mailbox->pop();
                 func(msg);
             }
@@ -446,7 +1387,7 @@ namespace rltk {
         virtual void update(const double duration_ms) override final {
             std::queue<MSG> * mailbox = base_system::mbox<MSG>();
             while (!mailbox->empty()) {
-                MSG msg = mailbox->front();
+                MSG msg = std::move(mailbox->front());
                 mailbox->pop();
                 on_message(msg);
             }
@@ -466,6 +1407,26 @@ namespace rltk {
          */
         entity_t * entity(const std::size_t id) noexcept;
 
+        /*
+         * Returns a generational handle to an entity, which can later be checked for staleness.
+         */
+        inline entity_handle_t handle(const entity_t &e) const noexcept {
+            entity_handle_t result;
+            result.slot = entity_store.slot_of(e.id);
+            if (result.slot != impl::entity_table_t::npos) result.version = entity_store.version(result.slot);
+            return result;
+        }
+
+        /*
+         * Resolves a handle to an entity; returns nullptr if the entity it referred to has been deleted (even if
+         * its slot has since been re-used).
+         */
+        inline entity_t * entity(const entity_handle_t &h) noexcept {
+            entity_t * result = entity_store.find(h);
+            if (result && result->deleted) result = nullptr;
+            return result;
+        }
+
         /*
          * Creates an entity with a new ID #. Returns a pointer to the entity, to enable
          * call chaining. For example create_entity()->assign(foo)->assign(bar)
@@ -485,6 +1446,8 @@ namespace rltk {
             if (!e) return;
 
             e->deleted = true;
+            pending_deletions.push_back(id);
+            if (change_tracking) deleted_since_checkpoint.push_back(id);
             for (auto &store : component_store) {
                 if (store) store->erase_by_entity_id(*this, id);
             }
@@ -501,9 +1464,7 @@ namespace rltk {
          * Deletes all entities
          */
         inline void delete_all_entities() noexcept  {
-            for (auto it=entity_store.begin(); it!=entity_store.end(); ++it) {
-                delete_entity(it->first);
-            }
+            entity_store.for_each([this] (entity_t &e) { delete_entity(e.id); });
         }
 
         /*
@@ -513,32 +1474,37 @@ namespace rltk {
         inline void delete_component(const std::size_t entity_id, bool delete_entity_if_empty=false) noexcept {
             auto eptr = entity(entity_id);
             if (!eptr) return;
-            entity_t e = *entity(entity_id);
-            C empty_component;
-            impl::component_t<C> temp(empty_component);
-            if (!e.component_mask.test(temp.family_id)) return;
-            for (impl::component_t<C> &component : static_cast<impl::component_store_t<impl::component_t<C>> *>(component_store[temp.family_id].get())->components) {
-                if (component.entity_id == entity_id) {
-                    component.deleted = true;
-                    unset_component_mask(entity_id, temp.family_id, delete_entity_if_empty);
-                }
+            const std::size_t family_id = impl::component_t<C>::type_family();
+            if (!eptr->component_mask.test(family_id)) return;
+            auto * store = static_cast<impl::component_store_t<impl::component_t<C>> *>(component_store[family_id].get());
+            if (store->mark_deleted(entity_id)) {
+                unset_component_mask(entity_id, family_id, delete_entity_if_empty);
             }
         }
 
+        /*
+         * By default, deleting components of type C may reorder the rest of that type's components (the
+         * last one is moved into the gap). Call this with true for component types whose iteration order
+         * matters to your systems; removal is then O(n) in the number of components after the gap.
+         */
+        template<class C>
+        inline void preserve_component_order(const bool stable=true) {
+            impl::store_for<C>(*this)->stable_order = stable;
+        }
+
         /*
          * Finds all entities that have a component of the type specified, and returns a
          * vector of pointers to the entities. It does not check for component deletion.
          */
         template<class C>
         inline std::vector<entity_t *> entities_with_component() {
-            C empty_component;
             std::vector<entity_t *> result;
-            impl::component_t<C> temp(empty_component);
-            for (auto it=entity_store.begin(); it!=entity_store.end(); ++it) {
-                if (!it->second.deleted && it->second.component_mask.test(temp.family_id)) {
-                    result.push_back(&it->second);
+            const std::size_t family_id = impl::component_t<C>::type_family();
+            entity_store.for_each([&result, &family_id] (entity_t &e) {
+                if (!e.deleted && e.component_mask.test(family_id)) {
+                    result.push_back(&e);
                 }
-            }
+            });
             return result;
         }
 
@@ -550,11 +1516,12 @@ namespace rltk {
          */
         template <class C>
         inline void all_components(typename std::function<void(entity_t &, C &)> func) {
-            C empty_component;
-            impl::component_t<C> temp(empty_component);
-            for (impl::component_t<C> &component : static_cast<impl::component_store_t<impl::component_t<C>> *>(component_store[temp.family_id].get())->components) {
+            const std::size_t family_id = impl::component_t<C>::type_family();
+            auto * store = static_cast<impl::component_store_t<impl::component_t<C>> *>(component_store[family_id].get());
+            for (impl::component_t<C> &component : store->components) {
                 entity_t e = *entity(component.entity_id);
                 if (!e.deleted && !component.deleted) {
+                    if (store->track_changes) component.dirty = true;
                     func(e, component.data);
                 }
             }
@@ -569,25 +1536,14 @@ namespace rltk {
         /*
          * Variadic each. Use this to call a function for all entities having a discrete set of components. For example,
          * each<position, ai>([] (entity_t &e, position &pos, ai &brain) { ... code ... });
+         *
+         * The smallest of the requested component stores drives the iteration; the other components are joined
+         * through their stores' entity index, so the cost is proportional to the rarest component rather than
+         * to the number of entities.
          */
         template <typename... Cs, typename F>
         inline void each(F callback) {
-            std::array<size_t, sizeof...(Cs)> family_ids{ {impl::component_t<Cs>{}.family_id...} };
-            for (auto it=entity_store.begin(); it!=entity_store.end(); ++it) {
-                if (!it->second.deleted) {
-                    bool matches = true;
-                    for (const std::size_t &compare : family_ids) {
-                        if (!it->second.component_mask.test(compare)) {
-                            matches = false;
-                            break;
-                        }
-                    }
-                    if (matches) {
-                        // Call the functor
-                        callback(it->second, *it->second.component<Cs>()...);
-                    }
-                }
-            }
+            each_if<Cs...>([] (entity_t &, Cs &...) { return true; }, callback);
         }
 
         /*
@@ -597,46 +1553,67 @@ namespace rltk {
          */
         template <typename... Cs, typename P, typename F>
         inline void each_if(P&& predicate, F callback) {
-            std::array<size_t, sizeof...(Cs)> family_ids{ {impl::component_t<Cs>{}.family_id...} };
-            for (auto it=entity_store.begin(); it!=entity_store.end(); ++it) {
-                if (!it->second.deleted) {
-                    bool matches = true;
-                    for (const std::size_t &compare : family_ids) {
-                        if (!it->second.component_mask.test(compare)) {
-                            matches = false;
-                            break;
-                        }
-                    }
-                    if (matches && predicate(it->second, *it->second.component<Cs>()...)) {
-                        // Call the functor
-                        callback(it->second, *it->second.component<Cs>()...);
-                    }
-                }
-            }
+            each_if_impl<Cs...>(predicate, callback, std::integral_constant<bool, sizeof...(Cs) == 0>{});
+        }
+
+        /*
+         * Data-parallel version of each: parallel_each<position, ai>([] (entity_t &e, position &pos, ai &brain) { ... });
+         * The smallest of the requested component stores is split into ranges, which are processed concurrently
+         * on the default thread pool; it returns once every entity has been visited. Visiting order is not defined.
+         *
+         * Inside the callback it is safe to:
+         * - read and modify the components passed to it (they belong only to the entity being visited).
+         * - read anything that nothing else is modifying - entity(id), and other entities' components.
+         * - call emit_deferred (delivered after the calling system, as with each).
+         * It is NOT safe to create or delete entities, assign or delete components, emit (non-deferred) messages,
+         * run garbage collection, or modify other entities' components.
+         */
+        template <typename... Cs, typename F>
+        inline void parallel_each(F callback) {
+            static_assert(sizeof...(Cs) > 0, "parallel_each requires at least one component type");
+            const std::size_t driver = select_driver<Cs...>();
+            if (driver == impl::NO_INDEX) return;
+
+            std::size_t i = 0;
+            using expander = int[];
+            (void)expander{ 0, ((i++ == driver) ? (parallel_each_driven_by<Cs>(callback, find_store<Cs>()...), 0) : 0)... };
+        }
+
+        /*
+         * Returns the store for component type C, or nullptr if no component of that type has been assigned.
+         */
+        template <class C>
+        inline impl::component_store_t<impl::component_t<C>> * find_store() noexcept {
+            const std::size_t family_id = impl::component_t<C>::type_family();
+            if (component_store.size() <= family_id) return nullptr;
+            return static_cast<impl::component_store_t<impl::component_t<C>> *>(component_store[family_id].get());
         }
 
         /*
-         * This should be called periodically to actually erase all entities and components that are marked as deleted.
+         * This should be called periodically to actually erase entities and components that are marked as deleted.
+         * Only entities queued by delete_entity (or emptied by delete_component) and stores with deleted components
+         * are visited, so it costs nothing when nothing was deleted. If max_entities is non-zero, at most that many
+         * entities are erased (oldest first), and the rest wait for the next call - use this to spread a large
+         * despawn over several frames. Deleted entities are invisible to entity() and each either way.
          */
-        inline void ecs_garbage_collect() {
-            std::unordered_set<std::size_t> entities_to_delete;
+        inline void ecs_garbage_collect(const std::size_t max_entities = 0) {
+            std::size_t n = pending_deletions.size();
+            if (max_entities > 0 && n > max_entities) n = max_entities;
 
-            // Ensure that components are marked as deleted, and list out entities for erasure
-            for (auto it=entity_store.begin(); it!=entity_store.end(); ++it) {
-                if (it->second.deleted) {
-                    for (std::unique_ptr<impl::base_component_store> &store : component_store) {
-                        if (store) store->erase_by_entity_id(*this, it->second.id);
-                    }
-                    entities_to_delete.insert(it->second.id);
+            for (std::size_t i=0; i<n; ++i) {
+                const std::size_t id = pending_deletions.front();
+                pending_deletions.pop_front();
+
+                // Ensure that components are marked as deleted, and release the entity's slot
+                for (std::unique_ptr<impl::base_component_store> &store : component_store) {
+                    if (store) store->erase_by_entity_id(*this, id);
                 }
+                entity_store.erase(id);
             }
 
-            // Actually delete entities
-            for (const std::size_t &id : entities_to_delete) entity_store.erase(id);
-
             // Now we erase components
             for (std::unique_ptr<impl::base_component_store> &store : component_store) {
-                if (store) store->really_delete();
+                if (store && store->deleted_count > 0) store->really_delete();
             }
         }
 
@@ -646,34 +1623,28 @@ namespace rltk {
          */
         template <class MSG>
         inline void emit(MSG message) {
-            impl::message_t<MSG> handle(message);
-            if (pubsub_holder.size() > handle.family_id) {
-                for (auto &func : static_cast<impl::subscription_holder_t<MSG> *>(pubsub_holder[handle.family_id].get())->subscriptions) {
-                    if (std::get<0>(func) && std::get<1>(func)) {
-                        std::get<1>(func)(message);
-                    } else {
-                        // It is destined for the system's mailbox queue.
-                        auto finder = std::get<2>(func)->mailboxes.find(handle.family_id);
-                        if (finder != std::get<2>(func)->mailboxes.end()) {
-                            static_cast<impl::mailbox_t<MSG> *>(finder->second.get())->messages.push(message);
-                        }
-                    }
-                }
+            const std::size_t family_id = impl::message_t<MSG>::type_family();
+            if (pubsub_holder.size() > family_id && pubsub_holder[family_id]) {
+                static_cast<impl::subscription_holder_t<MSG> *>(pubsub_holder[family_id].get())->dispatch(message, true);
             }
         }
 
         /*
          * Submits a message for delivery. It will be delivered to every system that has issued a subscribe or subscribe_mbox
-         * call at the end of the next system execution. This is thead-safe, so you can emit_defer from within a parallel_each.
+         * call at the end of the next system execution. This is thead-safe, so you can emit_defer from within a parallel_each;
+         * each thread stages its messages separately, so concurrent emitters don't contend.
          */
         template <class MSG>
         inline void emit_deferred(MSG message) {
-            impl::message_t<MSG> handle(message);
-            if (pubsub_holder.size() > handle.family_id) {
-
-                auto * subholder = static_cast<impl::subscription_holder_t<MSG> *>(pubsub_holder[handle.family_id].get());
-                std::lock_guard<std::mutex> postlock(subholder->delivery_mutex);
-                subholder->delivery_queue.push(message);
+            const std::size_t family_id = impl::message_t<MSG>::type_family();
+            if (pubsub_holder.size() > family_id && pubsub_holder[family_id]) {
+                if (impl::current_staging) {
+                    // Running under ecs_tick_parallel; delivered in order when the system finishes
+                    std::lock_guard<std::mutex> postlock(impl::current_staging->lock);
+                    impl::current_staging->messages.emplace_back(family_id, [this, msg = std::move(message)] () mutable { emit<MSG>(std::move(msg)); });
+                    return;
+                }
+                static_cast<impl::subscription_holder_t<MSG> *>(pubsub_holder[family_id].get())->enqueue(std::move(message));
             }
         }
 
@@ -682,6 +1653,7 @@ namespace rltk {
         inline void add_system( Args && ... args ) {
             system_store.push_back(std::make_unique<S>( std::forward<Args>(args) ... ));
             system_profiling.push_back(system_profiling_t{});
+            schedule_dirty = true;
         }
 
         void delete_all_systems();
@@ -690,17 +1662,64 @@ namespace rltk {
 
         void ecs_tick(const double duration_ms);
 
+        /*
+         * As ecs_tick, but systems whose declared access doesn't conflict run concurrently on the default
+         * thread pool. Systems keep their registration order wherever they conflict, and each system's
+         * deferred messages are delivered as soon as it finishes (before any system that depends on it starts),
+         * in the same order ecs_tick would use. Messages deferred from outside a system are delivered at the end.
+         */
+        void ecs_tick_parallel(const double duration_ms);
+
         void ecs_save(std::unique_ptr<std::ofstream> &lbfile);
 
         void ecs_load(std::unique_ptr<std::ifstream> &lbfile);
 
+        /*
+         * As above, for any stream - such as a compressed_ostream/compressed_istream.
+         */
+        void ecs_save(std::ostream &lbfile);
+
+        void ecs_load(std::istream &lbfile);
+
+        /*
+         * Binary snapshots: a versioned, column-oriented alternative to ecs_save/ecs_load. Each component store is
+         * written as raw arrays (for trivially copyable components) so that loading maps the file and copies
+         * each array in one go, rather than deserializing element by element. Other component types fall back
+         * to cereal within their section. Snapshots are tied to the program that wrote them: component families
+         * must be allocated in the same order, and the machine must have the same word size and byte order.
+         */
+        void ecs_save_snapshot(const std::string &filename);
+
+        void ecs_load_snapshot(const std::string &filename);
+
+        /*
+         * Delta saves. With change tracking on, the ECS records which entities were created or deleted and which
+         * components were assigned, removed or handed out for modification (by component(), each and
+         * all_components - whether or not they were actually changed). ecs_save_delta writes just those changes
+         * since the last checkpoint, and starts a new one; ecs_apply_delta replays them. Checkpoints are also
+         * taken by ecs_checkpoint, ecs_save, ecs_save_snapshot and loading. See also ecs_compact_snapshot.
+         */
+        void ecs_track_changes(const bool enabled=true);
+
+        void ecs_checkpoint();
+
+        void ecs_save_delta(const std::string &filename);
+
+        void ecs_apply_delta(const std::string &filename);
+
         std::string ecs_profile_dump();
 
         // The ECS component store
         std::vector<std::unique_ptr<impl::base_component_store>> component_store;
 
         // The ECS entity store
-        std::unordered_map<std::size_t, entity_t> entity_store;
+        impl::entity_table_t entity_store;
+
+        // Entities marked as deleted, waiting for garbage collection
+        std::deque<std::size_t> pending_deletions;
+
+        // Maximum number of entities ecs_tick will garbage collect per tick; 0 means no limit.
+        std::size_t gc_budget = 0;
 
         // Mailbox system
         std::vector<std::unique_ptr<impl::subscription_base_t>> pubsub_holder;
@@ -711,12 +1730,119 @@ namespace rltk {
         // Profile data storage
         std::vector<system_profiling_t> system_profiling;
 
+        // Change tracking, for delta saves
+        bool change_tracking = false;
+        std::vector<std::size_t> created_since_checkpoint;
+        std::vector<std::size_t> deleted_since_checkpoint;
+
+        // Parallel schedule: for each system, the systems that must wait for it, and how many it waits for
+        bool schedule_dirty = true;
+        std::vector<std::vector<std::size_t>> schedule_successors;
+        std::vector<std::size_t> schedule_dependencies;
+
         // Helpers
+        /*
+         * Walks the dense vector of the driving component store D, joining the other requested components
+         * through their entity index. Indexes are used rather than iterators, since the callback may add
+         * components (and reallocate the vector).
+         */
+        template <typename... Cs, typename P, typename F>
+        inline void each_if_impl(P &predicate, F &callback, std::false_type) {
+            const std::size_t driver = select_driver<Cs...>();
+            if (driver == impl::NO_INDEX) return;
+
+            // Dispatch to the driver's concrete type
+            std::size_t i = 0;
+            using expander = int[];
+            (void)expander{ 0, ((i++ == driver) ? (each_in_range<Cs>(predicate, callback, 0, find_store<Cs>()->components.size(), find_store<Cs>()...), 0) : 0)... };
+        }
+
+        /* With no component types requested, every live entity matches */
+        template <typename... Cs, typename P, typename F>
+        inline void each_if_impl(P &predicate, F &callback, std::true_type) {
+            entity_store.for_each([&predicate, &callback] (entity_t &e) {
+                if (!e.deleted && predicate(e)) callback(e);
+            });
+        }
+
+        /*
+         * Picks the smallest of the stores for Cs... to drive an iteration, returning its position in Cs. If any of
+         * the stores doesn't exist (so nothing can match), returns npos.
+         */
+        template <typename... Cs>
+        inline std::size_t select_driver() noexcept {
+            const std::array<impl::base_component_store *, sizeof...(Cs)> stores{ {find_store<Cs>()...} };
+            std::size_t driver = 0;
+            for (std::size_t i=0; i<stores.size(); ++i) {
+                if (!stores[i]) return impl::NO_INDEX;
+                if (stores[i]->size() < stores[driver]->size()) driver = i;
+            }
+            return driver;
+        }
+
+        /*
+         * Walks the [begin, end) range of the dense vector of the driving component store D, joining the other
+         * requested components through their entity index. Indexes are used rather than iterators, since the
+         * callback may add components (and reallocate the vector).
+         */
+        template <class D, typename P, typename F, typename... Stores>
+        inline void each_in_range(P &predicate, F &callback, const std::size_t begin, const std::size_t end, Stores *... stores) {
+            auto * driver = find_store<D>();
+            const impl::component_mask_t &query = impl::query_mask<typename Stores::component_type...>();
+            for (std::size_t i=begin; i<end; ++i) {
+                if (driver->components[i].deleted) continue;
+                const std::size_t id = driver->components[i].entity_id;
+                entity_t * e = entity(id);
+                if (!e) continue;
+
+                if (!e->component_mask.contains(query)) continue;
+
+                if (predicate(*e, stores->find(id)->data...)) {
+                    callback(*e, stores->touch(id)->data...);
+                }
+            }
+        }
+
+        /*
+         * Splits the driving store D into ranges that start on cache-line multiples, and runs each_in_range on
+         * each of them on the default thread pool.
+         */
+        template <class D, typename F, typename... Stores>
+        inline void parallel_each_driven_by(F &callback, Stores *... stores) {
+            const std::size_t count = find_store<D>()->components.size();
+            if (count == 0) return;
+
+            thread_pool &pool = default_thread_pool();
+            const std::size_t step = impl::items_per_cache_line<impl::component_t<D>>();
+            std::size_t chunk = count / (pool.size() * 4) + 1;
+            chunk = ((chunk + step - 1) / step) * step;
+
+            auto predicate = [] (entity_t &, auto &...) { return true; };
+            impl::deferred_staging_t * staging = impl::current_staging;
+
+            pool.parallel_for((count + chunk - 1) / chunk, [&] (const std::size_t c) {
+                // Deferred messages go wherever the calling system's would
+                impl::deferred_staging_t * previous = impl::current_staging;
+                impl::current_staging = staging;
+                try {
+                    each_in_range<D>(predicate, callback, c * chunk, std::min(count, (c + 1) * chunk), stores...);
+                } catch (...) {
+                    impl::current_staging = previous;
+                    throw;
+                }
+                impl::current_staging = previous;
+            });
+        }
+
         inline void unset_component_mask(const std::size_t id, const std::size_t family_id, bool delete_if_empty) {
-            auto finder = entity_store.find(id);
-            if (finder != entity_store.end()) {
-                finder->second.component_mask.reset(family_id);
-                if (delete_if_empty && finder->second.component_mask.none()) finder->second.deleted = true;
+            entity_t * e = entity_store.find(id);
+            if (e) {
+                e->component_mask.reset(family_id);
+                if (delete_if_empty && !e->deleted && e->component_mask.none()) {
+                    e->deleted = true;
+                    pending_deletions.push_back(id);
+                    if (change_tracking) deleted_since_checkpoint.push_back(id);
+                }
             }
         }
 
@@ -738,16 +1864,24 @@ namespace rltk {
     };
 
     namespace impl {
+        template <class C>
+        inline impl::component_store_t<impl::component_t<C>> * store_for(ecs &ECS) {
+            const std::size_t family_id = impl::component_t<C>::type_family();
+            if (ECS.component_store.size() < family_id+1) {
+                ECS.component_store.resize(family_id+1);
+            }
+            if (!ECS.component_store[family_id]) {
+                ECS.component_store[family_id] = std::move(std::make_unique<impl::component_store_t<impl::component_t<C>>>());
+                ECS.component_store[family_id]->track_changes = ECS.change_tracking;
+            }
+            return static_cast<impl::component_store_t<impl::component_t<C>> *>(ECS.component_store[family_id].get());
+        }
+
         template <class C>
         inline void assign(ecs &ECS, entity_t &E, C component) {
             impl::component_t<C> temp(component);
             temp.entity_id = E.id;
-            if (ECS.component_store.size() < temp.family_id+1) {
-                ECS.component_store.resize(temp.family_id+1);
-            }
-            if (!ECS.component_store[temp.family_id]) ECS.component_store[temp.family_id] = std::move(std::make_unique<impl::component_store_t<impl::component_t<C>>>());
-
-            static_cast<impl::component_store_t<impl::component_t<C>> *>(ECS.component_store[temp.family_id].get())->components.push_back(temp);
+            store_for<C>(ECS)->add(temp);
             E.component_mask.set(temp.family_id);
         }
 
@@ -756,44 +1890,57 @@ namespace rltk {
             C * result = nullptr;
             if (E.deleted) return result;
 
-            C empty_component;
-            impl::component_t<C> temp(empty_component);
-            if (!E.component_mask.test(temp.family_id)) return result;
-            for (impl::component_t<C> &component : static_cast<impl::component_store_t<impl::component_t<C>> *>(ECS.component_store[temp.family_id].get())->components) {
-                if (component.entity_id == E.id) {
-                    result = &component.data;
-                    return result;
-                }
-            }
+            const std::size_t family_id = impl::component_t<C>::type_family();
+            if (!E.component_mask.test(family_id)) return result;
+            impl::component_t<C> * found = static_cast<impl::component_store_t<impl::component_t<C>> *>(ECS.component_store[family_id].get())->touch(E.id);
+            if (found) result = &found->data;
             return result;
         }
 
+        /* Finds (or creates) the subscription holder for a message type */
         template<class MSG>
-        inline void subscribe(ecs &ECS, base_system &B, std::function<void(MSG &message)> destination) {
-            MSG empty_message{};
-            impl::message_t<MSG> handle(empty_message);
-            if (ECS.pubsub_holder.size() < handle.family_id + 1) {
-                ECS.pubsub_holder.resize(handle.family_id + 1);
+        inline subscription_holder_t<MSG> * subscription_holder(ecs &ECS) {
+            const std::size_t family_id = impl::message_t<MSG>::type_family();
+            if (ECS.pubsub_holder.size() < family_id + 1) {
+                ECS.pubsub_holder.resize(family_id + 1);
             }
-            if (!ECS.pubsub_holder[handle.family_id]) {
-                ECS.pubsub_holder[handle.family_id] = std::move(std::make_unique<subscription_holder_t<MSG>>());
+            if (!ECS.pubsub_holder[family_id]) {
+                ECS.pubsub_holder[family_id] = std::make_unique<subscription_holder_t<MSG>>();
             }
-            static_cast<subscription_holder_t<MSG> *>(ECS.pubsub_holder[handle.family_id].get())->subscriptions.push_back(std::make_tuple(true,destination,nullptr));
+            return static_cast<subscription_holder_t<MSG> *>(ECS.pubsub_holder[family_id].get());
+        }
+
+        /*
+         * Subscribers read the message (deliveries run its handlers, or fill its mailbox), so ecs_tick_parallel
+         * mustn't run them alongside anything that emits it. This doesn't count as declaring access: a system
+         * that declares nothing else is still assumed to touch everything.
+         */
+        template<class MSG>
+        inline void reads_subscribed(ecs &ECS, base_system &B) {
+            const std::size_t family_id = impl::message_t<MSG>::type_family();
+            std::vector<std::size_t> &reads = B.access.message_reads;
+            if (std::find(reads.begin(), reads.end(), family_id) == reads.end()) reads.push_back(family_id);
+            ECS.schedule_dirty = true;
+        }
+
+        template<class MSG>
+        inline void subscribe(ecs &ECS, base_system &B, std::function<void(MSG &message)> destination) {
+            typename subscription_holder_t<MSG>::subscriber_t sub;
+            sub.callback = destination;
+            subscription_holder<MSG>(ECS)->subscriptions.push_back(sub);
+            reads_subscribed<MSG>(ECS, B);
         }
 
         template<class MSG>
         inline void subscribe_mbox(ecs &ECS, base_system &B) {
-            MSG empty_message{};
-            impl::message_t<MSG> handle(empty_message);
-            if (ECS.pubsub_holder.size() < handle.family_id + 1) {
-                ECS.pubsub_holder.resize(handle.family_id + 1);
-            }
-            if (!ECS.pubsub_holder[handle.family_id]) {
-                ECS.pubsub_holder[handle.family_id] = std::move(std::make_unique<subscription_holder_t<MSG>>());
-            }
-            std::function<void(MSG &message)> destination; // Deliberately empty
-            static_cast<impl::subscription_holder_t<MSG> *>(ECS.pubsub_holder[handle.family_id].get())->subscriptions.push_back(std::make_tuple(false,destination,&B));
-            B.mailboxes[handle.family_id] = std::make_unique<impl::mailbox_t<MSG>>();
+            // Re-use the mailbox if the system already has one, so that existing subscriptions stay valid
+            std::unique_ptr<subscription_mailbox_t> &mailbox = B.mailboxes[impl::message_t<MSG>::type_family()];
+            if (!mailbox) mailbox = std::make_unique<impl::mailbox_t<MSG>>();
+
+            typename subscription_holder_t<MSG>::subscriber_t sub;
+            sub.mailbox = &static_cast<impl::mailbox_t<MSG> *>(mailbox.get())->messages;
+            subscription_holder<MSG>(ECS)->subscriptions.push_back(sub);
+            reads_subscribed<MSG>(ECS, B);
         }
 
         inline void unset_component_mask(ecs &ECS, const std::size_t id, const std::size_t family_id, bool delete_if_empty) {
@@ -0,0 +1,505 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Path finding - A* specialized for maps that are a flat width x height grid.
+ */
+
+#include "path_finding.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+
+namespace rltk {
+
+/*
+ * grid_path_finder runs A* over a grid, keeping its scores, parents and open/closed state in flat arrays
+ * indexed by y*width+x. The arrays are allocated once and re-used by every search (a generation counter marks
+ * which entries belong to the current search, so nothing needs clearing between them), and no nodes are
+ * allocated while searching.
+ *
+ * It uses the same navigator_t as find_path_2d, which must additionally provide:
+ * - static int get_width() and static int get_height() - the size of the map. If these change, the arrays
+ *   are resized on the next search.
+ * - get_x, get_y and get_xy.
+ * Successors outside the map are ignored. The heuristic (get_distance_estimate) should be consistent, as
+ * the usual grid distance heuristics are: nodes are not re-opened once closed.
+ */
+template<class location_t, class navigator_t>
+class grid_path_finder {
+public:
+	/*
+	 * Searches from start to end; the result is in the same format as find_path.
+	 */
+	std::shared_ptr<navigation_path<location_t>> find_path(const location_t start, const location_t end) {
+		std::shared_ptr<navigation_path<location_t>> result = std::make_shared<navigation_path<location_t>>();
+		if (search(start, end)) {
+			result->success = true;
+			result->destination = end;
+			for (int idx = goal_index; idx != start_index; idx = parent[idx]) {
+				result->steps.push_front(location_at(idx));
+			}
+		}
+		return result;
+	}
+
+	/*
+	 * The number of nodes expanded by the last search.
+	 */
+	inline std::size_t nodes_expanded() const noexcept { return expanded; }
+
+private:
+	struct open_entry_t {
+		float f;
+		float g;
+		int index;
+	};
+
+	// Lowest f first; among equal f, the node furthest along (highest g) - on grids there are a great many
+	// ties, and this heads straight for the goal instead of widening the search front
+	struct open_compare_t {
+		bool operator()(const open_entry_t &a, const open_entry_t &b) const noexcept {
+			return a.f > b.f || (a.f == b.f && a.g < b.g);
+		}
+	};
+
+	int width = 0;
+	int height = 0;
+	std::uint32_t generation = 0;
+	std::vector<float> g;
+	std::vector<int> parent;
+	std::vector<std::uint32_t> seen;
+	std::vector<std::uint32_t> closed;
+	std::vector<open_entry_t> open;
+	std::vector<location_t> successors;
+	int start_index = -1;
+	int goal_index = -1;
+	std::size_t expanded = 0;
+
+	inline int index_of(location_t &loc) const {
+		const int x = navigator_t::get_x(loc);
+		const int y = navigator_t::get_y(loc);
+		if (x < 0 || y < 0 || x >= width || y >= height) return -1;
+		return (y * width) + x;
+	}
+
+	inline location_t location_at(const int idx) const {
+		return navigator_t::get_xy(idx % width, idx / width);
+	}
+
+	void begin_search() {
+		const int w = navigator_t::get_width();
+		const int h = navigator_t::get_height();
+		if (w != width || h != height) {
+			width = w;
+			height = h;
+			const std::size_t size = static_cast<std::size_t>(w) * static_cast<std::size_t>(h);
+			g.assign(size, 0.0f);
+			parent.assign(size, -1);
+			seen.assign(size, 0);
+			closed.assign(size, 0);
+			generation = 0;
+		}
+		if (++generation == 0) {
+			// Wrapped around, so old marks could look current
+			std::fill(seen.begin(), seen.end(), 0);
+			std::fill(closed.begin(), closed.end(), 0);
+			generation = 1;
+		}
+		open.clear();
+		expanded = 0;
+		goal_index = -1;
+	}
+
+	bool search(location_t start, location_t end) {
+		begin_search();
+		start_index = index_of(start);
+		if (start_index < 0) return false;
+
+		seen[start_index] = generation;
+		g[start_index] = 0.0f;
+		parent[start_index] = start_index;
+		open.push_back(open_entry_t{navigator_t::get_distance_estimate(start, end), 0.0f, start_index});
+
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), open_compare_t());
+			const int idx = open.back().index;
+			open.pop_back();
+
+			// Nodes are pushed again when a cheaper route is found, rather than re-ordering the heap; skip
+			// the stale copies
+			if (closed[idx] == generation) continue;
+			closed[idx] = generation;
+			++expanded;
+
+			location_t pos = location_at(idx);
+			if (navigator_t::is_goal(pos, end)) {
+				goal_index = idx;
+				return true;
+			}
+
+			successors.clear();
+			navigator_t::get_successors(pos, successors);
+			for (location_t &next : successors) {
+				const int n = index_of(next);
+				if (n < 0 || closed[n] == generation) continue;
+
+				const float new_g = g[idx] + navigator_t::get_cost(pos, next);
+				if (seen[n] == generation && g[n] <= new_g) continue;
+
+				seen[n] = generation;
+				g[n] = new_g;
+				parent[n] = idx;
+				open.push_back(open_entry_t{new_g + navigator_t::get_distance_estimate(next, end), new_g, n});
+				std::push_heap(open.begin(), open.end(), open_compare_t());
+			}
+		}
+		return false;
+	}
+};
+
+/*
+ * Jump Point Search, for grids where every move costs the same: orthogonal steps cost 1 and diagonal steps
+ * sqrt(2), whatever get_cost says. Rather than adding every neighbour to the open list, it "jumps" along
+ * straight and diagonal lines, only stopping at tiles where a new route opens up - so on open maps it expands
+ * a tiny fraction of the nodes A* would. Diagonal moves may not cut corners: both tiles beside the diagonal
+ * must be walkable. The goal is the end tile itself (is_goal is not used).
+ *
+ * The navigator needs get_x, get_y, get_xy, is_walkable, get_width and get_height.
+ *
+ * precompute_jumps() switches to JPS+: the result of every jump from every tile is stored (8 ints per tile),
+ * so searches don't scan the map at all. The table must be precomputed again whenever walkability changes;
+ * clear_jumps() goes back to scanning. A change of map size clears it automatically.
+ */
+template<class location_t, class navigator_t>
+class jump_point_path_finder {
+public:
+	/*
+	 * Searches from start to end; the result is in the same format as find_path.
+	 */
+	std::shared_ptr<navigation_path<location_t>> find_path(const location_t start, const location_t end) {
+		std::shared_ptr<navigation_path<location_t>> result = std::make_shared<navigation_path<location_t>>();
+		if (search(start, end)) {
+			result->success = true;
+			result->destination = end;
+			for (int idx = goal_index; idx != start_index; idx = parent[idx]) {
+				// Fill in the tiles between each jump point and its parent; they are always in a straight
+				// or diagonal line
+				const int px = parent[idx] % width;
+				const int py = parent[idx] / width;
+				int x = idx % width;
+				int y = idx / width;
+				const int dx = sign(px - x);
+				const int dy = sign(py - y);
+				while (x != px || y != py) {
+					result->steps.push_front(navigator_t::get_xy(x, y));
+					x += dx;
+					y += dy;
+				}
+			}
+		}
+		return result;
+	}
+
+	/*
+	 * Stores the result of every jump from every tile, so that searches are table lookups (JPS+).
+	 */
+	void precompute_jumps() {
+		resize();
+		jumps.assign(static_cast<std::size_t>(width) * static_cast<std::size_t>(height) * 8, 0);
+
+		// Straight jumps first, since diagonal jumps depend on them. Each line is swept from the far end, so the
+		// next tile along has always been done.
+		for (int dir=0; dir<8; dir += 2) {
+			const int dx = dir_x[dir];
+			const int dy = dir_y[dir];
+			for (int i=0; i<width*height; ++i) {
+				const int x = dx > 0 ? width - 1 - (i % width) : (i % width);
+				const int y = dy > 0 ? height - 1 - (i / width) : (i / width);
+				jumps[((y * width) + x) * 8 + dir] = precompute_step(x, y, dir, is_forced(x+dx, y+dy, dx, dy));
+			}
+		}
+		for (int dir=1; dir<8; dir += 2) {
+			const int dx = dir_x[dir];
+			const int dy = dir_y[dir];
+			for (int i=0; i<width*height; ++i) {
+				const int x = dx > 0 ? width - 1 - (i % width) : (i % width);
+				const int y = dy > 0 ? height - 1 - (i / width) : (i / width);
+				const bool jump_point = can_step(x, y, dx, dy) &&
+					(jumps[(((y+dy) * width) + x + dx) * 8 + direction(dx, 0)] > 0 ||
+					 jumps[(((y+dy) * width) + x + dx) * 8 + direction(0, dy)] > 0);
+				jumps[((y * width) + x) * 8 + dir] = precompute_step(x, y, dir, jump_point);
+			}
+		}
+	}
+
+	/*
+	 * Goes back to scanning the map for jumps.
+	 */
+	inline void clear_jumps() {
+		jumps.clear();
+		jumps.shrink_to_fit();
+	}
+
+	/*
+	 * The number of nodes expanded by the last search.
+	 */
+	inline std::size_t nodes_expanded() const noexcept { return expanded; }
+
+private:
+	struct open_entry_t {
+		float f;
+		float g;
+		int index;
+	};
+
+	struct open_compare_t {
+		bool operator()(const open_entry_t &a, const open_entry_t &b) const noexcept {
+			return a.f > b.f || (a.f == b.f && a.g < b.g);
+		}
+	};
+
+	// Directions, clockwise from east; odd ones are diagonal
+	static constexpr int dir_x[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+	static constexpr int dir_y[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+	int width = 0;
+	int height = 0;
+	std::uint32_t generation = 0;
+	std::vector<float> g;
+	std::vector<int> parent;
+	std::vector<std::uint32_t> seen;
+	std::vector<std::uint32_t> closed;
+	std::vector<open_entry_t> open;
+	std::vector<int> jumps;
+	int start_index = -1;
+	int goal_index = -1;
+	std::size_t expanded = 0;
+
+	static inline int sign(const int n) noexcept { return (n > 0) - (n < 0); }
+
+	static inline int direction(const int dx, const int dy) noexcept {
+		for (int dir=0; dir<8; ++dir) {
+			if (dir_x[dir] == dx && dir_y[dir] == dy) return dir;
+		}
+		return -1;
+	}
+
+	inline bool walkable(const int x, const int y) const {
+		return x >= 0 && y >= 0 && x < width && y < height && navigator_t::is_walkable(navigator_t::get_xy(x, y));
+	}
+
+	inline bool can_step(const int x, const int y, const int dx, const int dy) const {
+		if (!walkable(x+dx, y+dy)) return false;
+		return dx == 0 || dy == 0 || (walkable(x+dx, y) && walkable(x, y+dy));
+	}
+
+	// Arriving at x,y moving in a straight line, is there a route that didn't exist from the previous tile?
+	inline bool is_forced(const int x, const int y, const int dx, const int dy) const {
+		if (dx != 0) {
+			return (walkable(x, y-1) && !walkable(x-dx, y-1)) || (walkable(x, y+1) && !walkable(x-dx, y+1));
+		}
+		return (walkable(x-1, y) && !walkable(x-1, y-dy)) || (walkable(x+1, y) && !walkable(x+1, y-dy));
+	}
+
+	// Table entries are the number of steps to the jump point (positive) or to the wall (zero or negative)
+	inline int precompute_step(const int x, const int y, const int dir, const bool next_is_jump_point) const {
+		const int dx = dir_x[dir];
+		const int dy = dir_y[dir];
+		if (!walkable(x, y) || !can_step(x, y, dx, dy)) return 0;
+		if (next_is_jump_point) return 1;
+		const int after = jumps[(((y+dy) * width) + x + dx) * 8 + dir];
+		return after > 0 ? after + 1 : after - 1;
+	}
+
+	/*
+	 * Steps from x,y in direction dx,dy until reaching a jump point (returned) or a wall (-1).
+	 */
+	int jump(int x, int y, const int dx, const int dy) const {
+		for (;;) {
+			if (!can_step(x, y, dx, dy)) return -1;
+			x += dx;
+			y += dy;
+			const int idx = (y * width) + x;
+			if (idx == goal_index) return idx;
+			if (dx != 0 && dy != 0) {
+				if (jump(x, y, dx, 0) >= 0 || jump(x, y, 0, dy) >= 0) return idx;
+			} else if (is_forced(x, y, dx, dy)) {
+				return idx;
+			}
+		}
+	}
+
+	/*
+	 * As jump, using the precomputed table; the table doesn't know about the goal, so that is checked here.
+	 */
+	int jump_precomputed(const int x, const int y, const int dx, const int dy) const {
+		const int distance = jumps[((y * width) + x) * 8 + direction(dx, dy)];
+		const int reach = distance > 0 ? distance : -distance;
+		const int gx = goal_index % width;
+		const int gy = goal_index / width;
+
+		if (dx == 0 || dy == 0) {
+			// The goal is on this line, before the jump point or wall
+			const int along = dx != 0 ? (gx - x) * dx : (gy - y) * dy;
+			const bool on_line = dx != 0 ? gy == y : gx == x;
+			if (on_line && along > 0 && along <= reach) return goal_index;
+		} else if (sign(gx - x) == dx && sign(gy - y) == dy) {
+			// The diagonal crosses the goal's row or column before the jump point or wall; stop there, so that
+			// the straight line to the goal is searched
+			const int cross = std::min((gx - x) * dx, (gy - y) * dy);
+			if (cross <= reach && !(distance > 0 && distance < cross)) return ((y + dy * cross) * width) + x + dx * cross;
+		}
+		if (distance <= 0) return -1;
+		return ((y + dy * distance) * width) + x + dx * distance;
+	}
+
+	inline float octile(const int a, const int b) const {
+		const int dx = std::abs((a % width) - (b % width));
+		const int dy = std::abs((a / width) - (b / width));
+		return static_cast<float>(std::max(dx, dy) - std::min(dx, dy)) + 1.41421356f * static_cast<float>(std::min(dx, dy));
+	}
+
+	void resize() {
+		const int w = navigator_t::get_width();
+		const int h = navigator_t::get_height();
+		if (w != width || h != height) {
+			width = w;
+			height = h;
+			const std::size_t size = static_cast<std::size_t>(w) * static_cast<std::size_t>(h);
+			g.assign(size, 0.0f);
+			parent.assign(size, -1);
+			seen.assign(size, 0);
+			closed.assign(size, 0);
+			jumps.clear();
+			generation = 0;
+		}
+	}
+
+	bool search(location_t start, location_t end) {
+		resize();
+		if (++generation == 0) {
+			std::fill(seen.begin(), seen.end(), 0);
+			std::fill(closed.begin(), closed.end(), 0);
+			generation = 1;
+		}
+		open.clear();
+		expanded = 0;
+
+		const int sx = navigator_t::get_x(start);
+		const int sy = navigator_t::get_y(start);
+		const int ex = navigator_t::get_x(end);
+		const int ey = navigator_t::get_y(end);
+		if (sx < 0 || sy < 0 || sx >= width || sy >= height || ex < 0 || ey < 0 || ex >= width || ey >= height) return false;
+		start_index = (sy * width) + sx;
+		goal_index = (ey * width) + ex;
+		const bool precomputed = !jumps.empty();
+
+		seen[start_index] = generation;
+		g[start_index] = 0.0f;
+		parent[start_index] = start_index;
+		open.push_back(open_entry_t{octile(start_index, goal_index), 0.0f, start_index});
+
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), open_compare_t());
+			const int idx = open.back().index;
+			open.pop_back();
+			if (closed[idx] == generation) continue;
+			closed[idx] = generation;
+			++expanded;
+			if (idx == goal_index) return true;
+
+			// Only directions that might lead somewhere new: everything from the start; straight on and the
+			// diagonals either side of it (or the parts of a diagonal) otherwise - plus the sides, which open
+			// up when the tile behind them was blocked
+			const int x = idx % width;
+			const int y = idx / width;
+			int directions[8];
+			int n_directions = 0;
+			if (parent[idx] == idx) {
+				for (int dir=0; dir<8; ++dir) directions[n_directions++] = dir;
+			} else {
+				const int dx = sign(x - (parent[idx] % width));
+				const int dy = sign(y - (parent[idx] / width));
+				if (dx != 0 && dy != 0) {
+					directions[n_directions++] = direction(dx, dy);
+					directions[n_directions++] = direction(dx, 0);
+					directions[n_directions++] = direction(0, dy);
+				} else {
+					const int side_x = dy != 0 ? 1 : 0;
+					const int side_y = dx != 0 ? 1 : 0;
+					directions[n_directions++] = direction(dx, dy);
+					directions[n_directions++] = direction(dx + side_x, dy + side_y);
+					directions[n_directions++] = direction(dx - side_x, dy - side_y);
+					directions[n_directions++] = direction(side_x, side_y);
+					directions[n_directions++] = direction(-side_x, -side_y);
+				}
+			}
+
+			for (int i=0; i<n_directions; ++i) {
+				const int dx = dir_x[directions[i]];
+				const int dy = dir_y[directions[i]];
+				const int next = precomputed ? jump_precomputed(x, y, dx, dy) : jump(x, y, dx, dy);
+				if (next < 0 || closed[next] == generation) continue;
+
+				const int steps = std::max(std::abs((next % width) - x), std::abs((next / width) - y));
+				const float new_g = g[idx] + static_cast<float>(steps) * ((dx != 0 && dy != 0) ? 1.41421356f : 1.0f);
+				if (seen[next] == generation && g[next] <= new_g) continue;
+
+				seen[next] = generation;
+				g[next] = new_g;
+				parent[next] = idx;
+				open.push_back(open_entry_t{new_g + octile(next, goal_index), new_g, next});
+				std::push_heap(open.begin(), open.end(), open_compare_t());
+			}
+		}
+		return false;
+	}
+};
+
+template<class location_t, class navigator_t>
+constexpr int jump_point_path_finder<location_t, navigator_t>::dir_x[8];
+
+template<class location_t, class navigator_t>
+constexpr int jump_point_path_finder<location_t, navigator_t>::dir_y[8];
+
+namespace path_finding_detail {
+
+// Navigators opt in to Jump Point Search with: static constexpr bool uniform_cost = true;
+template<class navigator_t, class = void>
+struct declares_uniform_cost : std::false_type {};
+
+template<class navigator_t>
+struct declares_uniform_cost<navigator_t, typename std::enable_if<navigator_t::uniform_cost>::type> : std::true_type {};
+
+template<class location_t, class navigator_t>
+std::shared_ptr<navigation_path<location_t>> find_path_grid(const location_t &start, const location_t &end, std::false_type) {
+	static thread_local grid_path_finder<location_t, navigator_t> finder;
+	return finder.find_path(start, end);
+}
+
+template<class location_t, class navigator_t>
+std::shared_ptr<navigation_path<location_t>> find_path_grid(const location_t &start, const location_t &end, std::true_type) {
+	static thread_local jump_point_path_finder<location_t, navigator_t> finder;
+	return finder.find_path(start, end);
+}
+
+}
+
+/*
+ * Convenience wrapper: runs a grid_path_finder kept per thread (and per navigator), so repeated calls
+ * re-use its storage. If the navigator declares static constexpr bool uniform_cost = true, it uses a
+ * jump_point_path_finder instead.
+ */
+template<class location_t, class navigator_t>
+std::shared_ptr<navigation_path<location_t>> find_path_grid(const location_t start, const location_t end) {
+	return path_finding_detail::find_path_grid<location_t, navigator_t>(start, end,
+		path_finding_detail::declares_uniform_cost<navigator_t>());
+}
+
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Hierarchical path finding (HPA*) - fast long-distance paths on large grids.
+ */
+
+#include "path_finding.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstdlib>
+
+namespace rltk {
+
+/*
+ * hierarchical_path_finder splits the map into square clusters, and finds the entrances between neighbouring
+ * clusters (runs of open tiles along their shared edge, with one crossing point for short runs and one at
+ * each end of long ones). The cost of travelling between every pair of entrances within a cluster is
+ * precomputed, giving a small abstract graph. A query connects the start and end to the entrances of their
+ * clusters, searches the abstract graph, and then finds the real tiles for just the parts of the route it
+ * uses - each a search confined to one cluster. Short trips, between the same or neighbouring clusters, are
+ * searched directly instead.
+ *
+ * Paths are close to optimal, but not always optimal. When tiles change, pass them to tiles_changed: only the
+ * clusters containing them (and their neighbours, which share entrances) are recalculated, on the next query.
+ *
+ * It uses the same navigator_t as grid_path_finder: get_successors, get_cost, get_distance_estimate,
+ * is_walkable, get_x, get_y, get_xy, get_width and get_height. Moves are assumed to be reversible (as for
+ * dijkstra_map), and crossing between clusters to be possible between any two orthogonally adjacent
+ * walkable tiles.
+ */
+template<class location_t, class navigator_t>
+class hierarchical_path_finder {
+public:
+	explicit hierarchical_path_finder(const int cluster_size = 16) : cluster_size(std::max(cluster_size, 2)) {}
+
+	/*
+	 * Searches from start to end; the result is in the same format as find_path.
+	 */
+	std::shared_ptr<navigation_path<location_t>> find_path(const location_t start, const location_t end) {
+		std::shared_ptr<navigation_path<location_t>> result = std::make_shared<navigation_path<location_t>>();
+		update();
+
+		location_t s = start;
+		location_t e = end;
+		const int start_index = index_of(s);
+		const int end_index = index_of(e);
+		if (start_index < 0 || end_index < 0) return result;
+
+		if (short_trip(start_index, end_index, result->steps)) {
+			result->success = true;
+			result->destination = end;
+			return result;
+		}
+		if (!abstract_search(start_index, end_index)) return result;
+		for (std::size_t i=1; i<route.size(); ++i) {
+			if (!refine(route[i-1], route[i], result->steps)) return std::make_shared<navigation_path<location_t>>();
+		}
+		result->success = true;
+		result->destination = end;
+		return result;
+	}
+
+	/*
+	 * Marks the clusters containing these tiles for recalculation.
+	 */
+	void tiles_changed(const std::vector<location_t> &tiles) {
+		for (location_t tile : tiles) {
+			const int idx = index_of(tile);
+			if (idx >= 0) dirty[cluster_of(idx)] = 1;
+		}
+	}
+
+	/*
+	 * Recalculates everything, on the next query.
+	 */
+	inline void invalidate() {
+		width = 0;
+		height = 0;
+	}
+
+	/*
+	 * The number of entrance nodes in the abstract graph.
+	 */
+	std::size_t abstract_nodes() {
+		update();
+		std::size_t total = 0;
+		for (const cluster_t &c : clusters) total += c.nodes.size();
+		return total;
+	}
+
+private:
+	static constexpr float unreachable = std::numeric_limits<float>::max();
+
+	// Runs of entrance tiles at least this long get a crossing at each end, rather than one in the middle
+	static constexpr int long_entrance = 6;
+
+	struct link_t {
+		int from;
+		int to;
+		float cost;
+	};
+
+	struct cluster_t {
+		std::vector<int> nodes;    // Entrance tiles
+		std::vector<float> costs;  // nodes x nodes travel costs within the cluster
+		std::vector<link_t> links; // Crossings to neighbouring clusters
+	};
+
+	struct open_entry_t {
+		float f;
+		int index;
+	};
+
+	struct open_compare_t {
+		bool operator()(const open_entry_t &a, const open_entry_t &b) const noexcept { return a.f > b.f; }
+	};
+
+	const int cluster_size;
+	int width = 0;
+	int height = 0;
+	int clusters_wide = 0;
+	int clusters_high = 0;
+	std::vector<cluster_t> clusters;
+	std::vector<std::uint8_t> dirty;
+
+	// Search state, indexed by tile and re-used between searches
+	std::uint32_t generation = 0;
+	std::vector<std::uint32_t> seen;
+	std::vector<std::uint32_t> closed;
+	std::vector<float> g;
+	std::vector<int> parent;
+	std::vector<open_entry_t> open;
+	std::vector<location_t> successors;
+
+	// Per-query connections of the start and end to their clusters' entrances
+	std::vector<float> start_costs;
+	std::vector<float> end_costs;
+	float direct_cost = unreachable;
+	std::vector<int> route;
+	std::vector<int> segment;
+
+	inline int index_of(location_t &loc) const {
+		const int x = navigator_t::get_x(loc);
+		const int y = navigator_t::get_y(loc);
+		if (x < 0 || y < 0 || x >= width || y >= height) return -1;
+		return (y * width) + x;
+	}
+
+	inline location_t location_at(const int idx) const {
+		return navigator_t::get_xy(idx % width, idx / width);
+	}
+
+	inline bool walkable(const int x, const int y) const {
+		return navigator_t::is_walkable(navigator_t::get_xy(x, y));
+	}
+
+	inline int cluster_of(const int idx) const {
+		return ((idx / width) / cluster_size) * clusters_wide + ((idx % width) / cluster_size);
+	}
+
+	inline int slot_of(const cluster_t &c, const int tile) const {
+		return static_cast<int>(std::find(c.nodes.begin(), c.nodes.end(), tile) - c.nodes.begin());
+	}
+
+	void begin_search() {
+		if (++generation == 0) {
+			std::fill(seen.begin(), seen.end(), 0);
+			std::fill(closed.begin(), closed.end(), 0);
+			generation = 1;
+		}
+		open.clear();
+	}
+
+	inline void relax(const int idx, const float cost, const int from, const float estimate) {
+		if (closed[idx] == generation || (seen[idx] == generation && g[idx] <= cost)) return;
+		seen[idx] = generation;
+		g[idx] = cost;
+		parent[idx] = from;
+		open.push_back(open_entry_t{cost + estimate, idx});
+		std::push_heap(open.begin(), open.end(), open_compare_t());
+	}
+
+	inline int pop() {
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), open_compare_t());
+			const int idx = open.back().index;
+			open.pop_back();
+			if (closed[idx] != generation) {
+				closed[idx] = generation;
+				return idx;
+			}
+		}
+		return -1;
+	}
+
+	/*
+	 * Searches outwards from source, stopping early if target (if not -1) is reached. The search stays within
+	 * the clusters spanned by source and target, plus spread clusters around them. Afterwards g and parent
+	 * hold the results for every tile reached.
+	 */
+	void local_search(const int source, const int target, const int spread = 0) {
+		begin_search();
+		const int end = target < 0 ? source : target;
+		const int sx = (source % width) / cluster_size, sy = (source / width) / cluster_size;
+		const int ex = (end % width) / cluster_size, ey = (end / width) / cluster_size;
+		const int left = (std::min(sx, ex) - spread) * cluster_size;
+		const int top = (std::min(sy, ey) - spread) * cluster_size;
+		const int right = (std::max(sx, ex) + spread + 1) * cluster_size;
+		const int bottom = (std::max(sy, ey) + spread + 1) * cluster_size;
+
+		location_t goal = location_at(end);
+		relax(source, 0.0f, source, 0.0f);
+		for (int idx = pop(); idx >= 0 && idx != target; idx = pop()) {
+			location_t pos = location_at(idx);
+			successors.clear();
+			navigator_t::get_successors(pos, successors);
+			for (location_t &next : successors) {
+				const int n = index_of(next);
+				if (n < 0 || closed[n] == generation) continue;
+				const int x = n % width;
+				const int y = n / width;
+				if (x < left || y < top || x >= right || y >= bottom) continue;
+				const float estimate = target < 0 ? 0.0f : navigator_t::get_distance_estimate(next, goal);
+				relax(n, g[idx] + navigator_t::get_cost(pos, next), idx, estimate);
+			}
+		}
+	}
+
+	/*
+	 * Short trips (between the same or neighbouring clusters) are searched directly, over the clusters around
+	 * them. Going through the abstract graph would force them through its few crossing points, which can be a
+	 * long detour at this range.
+	 */
+	bool short_trip(const int start, const int end, std::deque<location_t> &steps) {
+		const int dx = (start % width) / cluster_size - (end % width) / cluster_size;
+		const int dy = (start / width) / cluster_size - (end / width) / cluster_size;
+		if (std::abs(dx) > 1 || std::abs(dy) > 1) return false;
+
+		local_search(start, end, 1);
+		if (reached_cost(end) == unreachable) return false;
+		append_steps(start, end, steps);
+		return true;
+	}
+
+	void append_steps(const int from, const int to, std::deque<location_t> &steps) {
+		segment.clear();
+		for (int idx = to; idx != from; idx = parent[idx]) segment.push_back(idx);
+		for (auto it = segment.rbegin(); it != segment.rend(); ++it) steps.push_back(location_at(*it));
+	}
+
+	inline float reached_cost(const int idx) const {
+		return seen[idx] == generation && closed[idx] == generation ? g[idx] : unreachable;
+	}
+
+	// Building the abstract graph
+
+	void update() {
+		if (navigator_t::get_width() != width || navigator_t::get_height() != height) {
+			width = navigator_t::get_width();
+			height = navigator_t::get_height();
+			clusters_wide = (width + cluster_size - 1) / cluster_size;
+			clusters_high = (height + cluster_size - 1) / cluster_size;
+			clusters.assign(static_cast<std::size_t>(clusters_wide) * clusters_high, cluster_t());
+			dirty.assign(clusters.size(), 1);
+			const std::size_t size = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+			seen.assign(size, 0);
+			closed.assign(size, 0);
+			g.assign(size, 0.0f);
+			parent.assign(size, -1);
+			generation = 0;
+		}
+
+		// A changed cluster's entrances are shared with its neighbours, so their entrances and costs are
+		// recalculated too
+		std::vector<std::uint8_t> rebuild(clusters.size(), 0);
+		bool any = false;
+		for (int cy=0; cy<clusters_high; ++cy) {
+			for (int cx=0; cx<clusters_wide; ++cx) {
+				if (!dirty[cy * clusters_wide + cx]) continue;
+				any = true;
+				for (int ny = std::max(cy-1, 0); ny <= std::min(cy+1, clusters_high-1); ++ny) {
+					for (int nx = std::max(cx-1, 0); nx <= std::min(cx+1, clusters_wide-1); ++nx) {
+						rebuild[ny * clusters_wide + nx] = 1;
+					}
+				}
+			}
+		}
+		if (!any) return;
+
+		for (std::size_t c=0; c<clusters.size(); ++c) {
+			if (rebuild[c]) find_entrances(static_cast<int>(c));
+		}
+		for (std::size_t c=0; c<clusters.size(); ++c) {
+			if (rebuild[c]) calculate_costs(static_cast<int>(c));
+		}
+		std::fill(dirty.begin(), dirty.end(), 0);
+	}
+
+	void add_node(cluster_t &c, const int tile) {
+		if (slot_of(c, tile) == static_cast<int>(c.nodes.size())) c.nodes.push_back(tile);
+	}
+
+	void add_crossing(cluster_t &c, const int inside, const int outside) {
+		add_node(c, inside);
+		location_t a = location_at(inside);
+		location_t b = location_at(outside);
+		c.links.push_back(link_t{inside, outside, navigator_t::get_cost(a, b)});
+	}
+
+	/*
+	 * Finds the crossings along one edge of a cluster. The tiles are walked in the same order from either side
+	 * of the edge, so both clusters agree on where the crossings are.
+	 */
+	void scan_edge(cluster_t &c, const int first_inside, const int first_outside, const int step, const int length) {
+		int run_start = -1;
+		for (int i=0; i<=length; ++i) {
+			const int inside = first_inside + i * step;
+			const int outside = first_outside + i * step;
+			const bool open_pair = i < length && walkable(inside % width, inside / width) && walkable(outside % width, outside / width);
+			if (open_pair && run_start < 0) run_start = i;
+			if (!open_pair && run_start >= 0) {
+				const int run_end = i - 1;
+				if (run_end - run_start + 1 >= long_entrance) {
+					add_crossing(c, first_inside + run_start * step, first_outside + run_start * step);
+					add_crossing(c, first_inside + run_end * step, first_outside + run_end * step);
+				} else {
+					const int mid = (run_start + run_end) / 2;
+					add_crossing(c, first_inside + mid * step, first_outside + mid * step);
+				}
+				run_start = -1;
+			}
+		}
+	}
+
+	void find_entrances(const int c) {
+		cluster_t &cluster = clusters[c];
+		cluster.nodes.clear();
+		cluster.links.clear();
+
+		const int cx = c % clusters_wide;
+		const int cy = c / clusters_wide;
+		const int left = cx * cluster_size;
+		const int top = cy * cluster_size;
+		const int right = std::min(left + cluster_size, width) - 1;
+		const int bottom = std::min(top + cluster_size, height) - 1;
+		const int w = right - left + 1;
+		const int h = bottom - top + 1;
+
+		if (top > 0) scan_edge(cluster, (top * width) + left, ((top-1) * width) + left, 1, w);
+		if (bottom < height-1) scan_edge(cluster, (bottom * width) + left, ((bottom+1) * width) + left, 1, w);
+		if (left > 0) scan_edge(cluster, (top * width) + left, (top * width) + left - 1, width, h);
+		if (right < width-1) scan_edge(cluster, (top * width) + right, (top * width) + right + 1, width, h);
+	}
+
+	void calculate_costs(const int c) {
+		cluster_t &cluster = clusters[c];
+		const std::size_t n = cluster.nodes.size();
+		cluster.costs.assign(n * n, unreachable);
+		for (std::size_t i=0; i<n; ++i) {
+			local_search(cluster.nodes[i], -1);
+			for (std::size_t j=0; j<n; ++j) cluster.costs[i*n + j] = reached_cost(cluster.nodes[j]);
+		}
+	}
+
+	// Queries
+
+	/*
+	 * Finds the sequence of entrances (starting with start and ending with end) to travel through.
+	 */
+	bool abstract_search(const int start, const int end) {
+		const int start_cluster = cluster_of(start);
+		const int end_cluster = cluster_of(end);
+		const cluster_t &sc = clusters[start_cluster];
+		const cluster_t &ec = clusters[end_cluster];
+
+		local_search(start, -1);
+		start_costs.resize(sc.nodes.size());
+		for (std::size_t i=0; i<sc.nodes.size(); ++i) start_costs[i] = reached_cost(sc.nodes[i]);
+		direct_cost = start_cluster == end_cluster ? reached_cost(end) : unreachable;
+
+		local_search(end, -1);
+		end_costs.resize(ec.nodes.size());
+		for (std::size_t i=0; i<ec.nodes.size(); ++i) end_costs[i] = reached_cost(ec.nodes[i]);
+
+		begin_search();
+		location_t goal = location_at(end);
+		auto estimate = [this, &goal] (const int idx) {
+			location_t pos = location_at(idx);
+			return navigator_t::get_distance_estimate(pos, goal);
+		};
+
+		relax(start, 0.0f, start, estimate(start));
+		for (int idx = pop(); idx >= 0; idx = pop()) {
+			if (idx == end) {
+				route.clear();
+				for (int i = end; i != start; i = parent[i]) route.push_back(i);
+				route.push_back(start);
+				std::reverse(route.begin(), route.end());
+				return true;
+			}
+
+			if (idx == start) {
+				for (std::size_t i=0; i<sc.nodes.size(); ++i) {
+					if (start_costs[i] != unreachable) relax(sc.nodes[i], start_costs[i], idx, estimate(sc.nodes[i]));
+				}
+				if (direct_cost != unreachable) relax(end, direct_cost, idx, 0.0f);
+				// The start may also be an entrance, so carry on to its links
+			}
+
+			const int cluster = cluster_of(idx);
+			const cluster_t &c = clusters[cluster];
+			const std::size_t n = c.nodes.size();
+			const std::size_t slot = static_cast<std::size_t>(slot_of(c, idx));
+			if (slot < n) {
+				for (std::size_t j=0; j<n; ++j) {
+					const float cost = c.costs[slot*n + j];
+					if (j != slot && cost != unreachable) relax(c.nodes[j], g[idx] + cost, idx, estimate(c.nodes[j]));
+				}
+				for (const link_t &link : c.links) {
+					if (link.from == idx) relax(link.to, g[idx] + link.cost, idx, estimate(link.to));
+				}
+				if (cluster == end_cluster && end_costs[slot] != unreachable) relax(end, g[idx] + end_costs[slot], idx, 0.0f);
+			}
+		}
+		return false;
+	}
+
+	/*
+	 * Appends the tiles from one entrance (or the start) to the next.
+	 */
+	bool refine(const int from, const int to, std::deque<location_t> &steps) {
+		if (cluster_of(from) != cluster_of(to)) {
+			steps.push_back(location_at(to));
+			return true;
+		}
+		local_search(from, to);
+		if (reached_cost(to) == unreachable) return false;
+		append_steps(from, to, steps);
+		return true;
+	}
+};
+
+template<class location_t, class navigator_t>
+constexpr float hierarchical_path_finder<location_t, navigator_t>::unreachable;
+
+template<class location_t, class navigator_t>
+constexpr int hierarchical_path_finder<location_t, navigator_t>::long_entrance;
+
+}
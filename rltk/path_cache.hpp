@@ -0,0 +1,220 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Caching of path finding results, invalidated by per-region map versions.
+ */
+
+#include "path_finding.hpp"
+#include <vector>
+#include <list>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <type_traits>
+
+namespace rltk {
+
+/*
+ * Version counters for square (or cubic) regions of a map. Whatever changes the map should call changed with
+ * the co-ordinates of each tile whose walkability (or cost) changes; path_cache uses the versions to tell which
+ * of its paths may be stale.
+ */
+class path_region_versions {
+public:
+	explicit path_region_versions(const int region_size = 16) : region_size(std::max(region_size, 1)) {}
+
+	/*
+	 * Records a change to the tile at x/y/z.
+	 */
+	inline void changed(const int x, const int y, const int z = 0) {
+		++global;
+		++versions[region_of(x, y, z)];
+	}
+
+	/*
+	 * Records a change to everything.
+	 */
+	inline void changed_all() {
+		++global;
+		++everything;
+	}
+
+	/*
+	 * Identifies the region containing x/y/z.
+	 */
+	inline std::uint64_t region_of(const int x, const int y, const int z = 0) const noexcept {
+		return (pack(x) << 42) | (pack(y) << 21) | pack(z);
+	}
+
+	/*
+	 * The number of changes recorded in a region (or in total).
+	 */
+	inline std::uint64_t version(const std::uint64_t region) const {
+		auto found = versions.find(region);
+		return everything + (found == versions.end() ? 0 : found->second);
+	}
+
+	inline std::uint64_t global_version() const noexcept { return global; }
+
+private:
+	const int region_size;
+	std::uint64_t global = 0;
+	std::uint64_t everything = 0;
+	std::unordered_map<std::uint64_t, std::uint64_t> versions;
+
+	// Region co-ordinates (rounded down, so negative co-ordinates work) in 21 bits each
+	inline std::uint64_t pack(const int c) const noexcept {
+		const int region = c >= 0 ? c / region_size : -((-c - 1) / region_size) - 1;
+		return static_cast<std::uint64_t>(region + (1 << 20)) & 0x1FFFFFu;
+	}
+};
+
+/*
+ * An LRU cache in front of find_path, find_path_2d and find_path_3d, for agents that keep asking for the same
+ * path while the map stays the same. Each cached path remembers the versions of the regions it passes through;
+ * it is searched again only if one of those regions has changed since. While nothing in the map has changed at
+ * all, a hit is a single lookup. Failed searches are cached too, until anything changes.
+ *
+ * Changes elsewhere can open up a shorter route than a cached path, which won't be noticed - a cached path is
+ * valid, but not necessarily still the best.
+ *
+ * Cached paths are shared, so they are returned as const; copy one before consuming its steps. A cache is not
+ * thread-safe: use one per thread.
+ */
+template<class location_t, class navigator_t>
+class path_cache {
+public:
+	path_cache(const path_region_versions &versions, const std::size_t capacity = 1024) :
+		versions(versions), capacity(std::max<std::size_t>(capacity, 1)) {}
+
+	std::shared_ptr<const navigation_path<location_t>> find_path(const location_t start, const location_t end) {
+		return lookup(search_t::plain, start, end, [] (const location_t s, const location_t e) { return rltk::find_path<location_t, navigator_t>(s, e); });
+	}
+
+	std::shared_ptr<const navigation_path<location_t>> find_path_2d(const location_t start, const location_t end) {
+		return lookup(search_t::line_2d, start, end, [] (const location_t s, const location_t e) { return rltk::find_path_2d<location_t, navigator_t>(s, e); });
+	}
+
+	std::shared_ptr<const navigation_path<location_t>> find_path_3d(const location_t start, const location_t end) {
+		return lookup(search_t::line_3d, start, end, [] (const location_t s, const location_t e) { return rltk::find_path_3d<location_t, navigator_t>(s, e); });
+	}
+
+	inline void clear() {
+		index.clear();
+		entries.clear();
+	}
+
+	inline std::size_t size() const noexcept { return entries.size(); }
+	inline std::size_t hits() const noexcept { return hit_count; }
+	inline std::size_t misses() const noexcept { return miss_count; }
+
+private:
+	enum class search_t { plain, line_2d, line_3d };
+
+	struct key_t {
+		search_t search;
+		location_t start;
+		location_t end;
+	};
+
+	struct key_hash {
+		std::size_t operator()(const key_t &key) const {
+			location_t start = key.start;
+			location_t end = key.end;
+			return hash(start) ^ (hash(end) * 31u) ^ static_cast<std::size_t>(key.search);
+		}
+	};
+
+	struct key_equal {
+		bool operator()(const key_t &a, const key_t &b) const {
+			location_t a_start = a.start, a_end = a.end, b_start = b.start, b_end = b.end;
+			return a.search == b.search && navigator_t::is_same_state(a_start, b_start) && navigator_t::is_same_state(a_end, b_end);
+		}
+	};
+
+	struct entry_t {
+		key_t key;
+		std::shared_ptr<const navigation_path<location_t>> path;
+		std::uint64_t checked_at;                                  // Global version when last known valid
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> regions; // Region, version - empty for a failed search
+	};
+
+	typedef std::list<entry_t> entry_list;
+
+	const path_region_versions &versions;
+	const std::size_t capacity;
+	entry_list entries; // Most recently used first
+	std::unordered_map<key_t, typename entry_list::iterator, key_hash, key_equal> index;
+	std::size_t hit_count = 0;
+	std::size_t miss_count = 0;
+
+	static inline std::size_t hash(location_t &pos) {
+		return path_finding_detail::hash_location<navigator_t>(pos, typename path_finding_detail::has_get_z<navigator_t, location_t>::type());
+	}
+
+	template<class T = navigator_t>
+	inline std::uint64_t region_of(location_t &pos, typename std::enable_if<path_finding_detail::has_get_z<T, location_t>::value>::type * = nullptr) const {
+		return versions.region_of(navigator_t::get_x(pos), navigator_t::get_y(pos), navigator_t::get_z(pos));
+	}
+
+	template<class T = navigator_t>
+	inline std::uint64_t region_of(location_t &pos, typename std::enable_if<!path_finding_detail::has_get_z<T, location_t>::value>::type * = nullptr) const {
+		return versions.region_of(navigator_t::get_x(pos), navigator_t::get_y(pos));
+	}
+
+	bool still_valid(entry_t &entry) const {
+		const std::uint64_t now = versions.global_version();
+		if (entry.checked_at == now) return true;
+		if (entry.regions.empty()) return false;
+		for (const auto &region : entry.regions) {
+			if (versions.version(region.first) != region.second) return false;
+		}
+		entry.checked_at = now;
+		return true;
+	}
+
+	// The search is passed in, so that only the kinds of search actually used are instantiated
+	template<class F>
+	std::shared_ptr<const navigation_path<location_t>> lookup(const search_t kind, const location_t start, const location_t end, F search) {
+		const key_t key{kind, start, end};
+		auto found = index.find(key);
+		if (found != index.end()) {
+			if (still_valid(*found->second)) {
+				++hit_count;
+				entries.splice(entries.begin(), entries, found->second);
+				return found->second->path;
+			}
+			entries.erase(found->second);
+			index.erase(found);
+		}
+		++miss_count;
+
+		entry_t entry{key, search(start, end), versions.global_version(), {}};
+		if (entry.path->success) {
+			location_t pos = start;
+			entry.regions.emplace_back(region_of(pos), 0);
+			for (const location_t &step : entry.path->steps) {
+				pos = step;
+				const std::uint64_t region = region_of(pos);
+				if (entry.regions.back().first != region) entry.regions.emplace_back(region, 0);
+			}
+			std::sort(entry.regions.begin(), entry.regions.end());
+			entry.regions.erase(std::unique(entry.regions.begin(), entry.regions.end()), entry.regions.end());
+			for (auto &region : entry.regions) region.second = versions.version(region.first);
+		}
+
+		if (entries.size() >= capacity) {
+			index.erase(entries.back().key);
+			entries.pop_back();
+		}
+		entries.push_front(std::move(entry));
+		index.emplace(key, entries.begin());
+		return entries.front().path;
+	}
+};
+
+}
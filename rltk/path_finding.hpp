@@ -16,9 +16,39 @@
 
 namespace rltk {
 
+namespace path_finding_detail {
+
+template<class navigator_t, class location_t, class = void>
+struct has_get_z : std::false_type {};
+
+template<class navigator_t, class location_t>
+struct has_get_z<navigator_t, location_t, decltype(void(navigator_t::get_z(std::declval<location_t &>())))> : std::true_type {};
+
+inline std::size_t hash_coordinates(const int x, const int y, const int z) {
+	return (static_cast<std::size_t>(x) * 73856093u) ^ (static_cast<std::size_t>(y) * 19349663u) ^ (static_cast<std::size_t>(z) * 83492791u);
+}
+
+template<class navigator_t, class location_t>
+inline std::size_t hash_location(location_t &pos, std::true_type) {
+	return hash_coordinates(navigator_t::get_x(pos), navigator_t::get_y(pos), navigator_t::get_z(pos));
+}
+
+template<class navigator_t, class location_t>
+inline std::size_t hash_location(location_t &pos, std::false_type) {
+	return hash_coordinates(navigator_t::get_x(pos), navigator_t::get_y(pos), 0);
+}
+
+}
+
 // Template class used to forward to specialize the algorithm to the user's map format and
 // and behaviors defined in navigator_t. This avoids the library mandating what your map
 // looks like.
+//
+// The search needs to find states it has already seen. If navigator_t provides
+// get_index(location_t) - a unique, small non-negative integer per location, such as y*width+x - that is
+// used to index a flat table. Otherwise, if it provides get_x and get_y (and get_z, in 3D), locations are
+// hashed by co-ordinate; that requires is_same_state to be false for locations with different co-ordinates.
+// Navigators with neither fall back to a (slow) linear search.
 template<class location_t, class navigator_t>
 class map_search_node {
 public:
@@ -41,17 +71,15 @@ public:
 
 	bool GetSuccessors(AStarSearch<map_search_node<location_t, navigator_t>> * a_star_search, map_search_node<location_t, navigator_t> * parent_node) {
 		//std::cout << "GetSuccessors called.\n";
-		std::vector<location_t> successors;
-
-		if (parent_node != nullptr) {		
-			navigator_t::get_successors(parent_node->pos, successors);			
-		} else {
-			throw std::runtime_error("Null parent error.");
-		}
+		// parent_node is the node we were reached from, not the one being expanded. The successor list is
+		// re-used, to avoid an allocation per node.
+		static thread_local std::vector<location_t> successors;
+		successors.clear();
+		navigator_t::get_successors(pos, successors);
 		for (location_t loc : successors) {
 			map_search_node<location_t, navigator_t> tmp(loc);
 			//std::cout << " --> " << loc.x << "/" << loc.y << "\n";
-			a_star_search->AddSuccessor( tmp );
+			if (!a_star_search->AddSuccessor( tmp )) return false; // Out of nodes
 		}
 		return true;
 	}
@@ -68,6 +96,16 @@ public:
 		//std::cout << "IsSameState called (" << result << ").\n";
 		return result;
 	}
+
+	template<class N = navigator_t>
+	auto DenseIndex() -> decltype(static_cast<std::size_t>(N::get_index(std::declval<location_t &>()))) {
+		return static_cast<std::size_t>(N::get_index(pos));
+	}
+
+	template<class N = navigator_t>
+	auto Hash() -> decltype(N::get_x(std::declval<location_t &>()), N::get_y(std::declval<location_t &>()), std::size_t()) {
+		return path_finding_detail::hash_location<N>(pos, path_finding_detail::has_get_z<N, location_t>());
+	}
 };
 
 // Template class used to define what a navigation path looks like
@@ -78,6 +116,119 @@ struct navigation_path {
 	std::deque<location_t> steps;
 };
 
+/*
+ * A path finder that keeps its A* node pool and lists between searches, and writes paths into storage you
+ * provide - so once it has warmed up, searching doesn't allocate. Keep one around (per thread) rather than
+ * calling the free find_path functions, if you are searching a lot.
+ *
+ * Each search fills steps with the path (not including start, but including end) and returns true, or
+ * clears it and returns false. max_nodes is the size of the node pool: searches that need more nodes than
+ * that fail.
+ */
+template<class location_t, class navigator_t>
+class path_finder {
+public:
+	explicit path_finder(const int max_nodes = 10000) : a_star_search(max_nodes) {}
+
+	path_finder(const path_finder &) = delete;
+	path_finder &operator=(const path_finder &) = delete;
+
+	/*
+	 * Plain A*, as find_path.
+	 */
+	bool find_path(const location_t start, const location_t end, std::vector<location_t> &steps) {
+		map_search_node<location_t, navigator_t> a_start(start);
+		map_search_node<location_t, navigator_t> a_end(end);
+
+		steps.clear();
+		a_star_search.SetStartAndGoalStates(a_start, a_end);
+		unsigned int search_state;
+		do {
+			search_state = a_star_search.SearchStep();
+		} while (search_state == search_t::SEARCH_STATE_SEARCHING);
+
+		if (search_state == search_t::SEARCH_STATE_SUCCEEDED) {
+			a_star_search.GetSolutionStart();
+			for (;;) {
+				map_search_node<location_t, navigator_t> * node = a_star_search.GetSolutionNext();
+				if (!node) break;
+				steps.push_back(node->pos);
+			}
+			a_star_search.FreeSolutionNodes();
+		}
+		a_star_search.EnsureMemoryFreed();
+		return search_state == search_t::SEARCH_STATE_SUCCEEDED;
+	}
+
+	/*
+	 * As find_path_2d: tries a straight line first, falling back to A*. As with find_path_2d, a straight line
+	 * path also includes the start.
+	 */
+	bool find_path_2d(const location_t start, const location_t end, std::vector<location_t> &steps) {
+		steps.clear();
+		bool clear = true;
+		line_func(navigator_t::get_x(start), navigator_t::get_y(start), navigator_t::get_x(end), navigator_t::get_y(end), [&clear, &steps] (int X, int Y) {
+			location_t step = navigator_t::get_xy(X,Y);
+			if (clear && navigator_t::is_walkable(step)) {
+				steps.push_back(step);
+			} else {
+				clear = false;
+			}
+		});
+		if (clear) return true;
+		return find_path(start, end, steps);
+	}
+
+	/*
+	 * As find_path_3d: tries a straight line first, falling back to A*. As with find_path_3d, a straight line
+	 * path also includes the start.
+	 */
+	bool find_path_3d(const location_t start, const location_t end, std::vector<location_t> &steps) {
+		steps.clear();
+		bool clear = true;
+		line_func3d(navigator_t::get_x(start), navigator_t::get_y(start), navigator_t::get_z(start), navigator_t::get_x(end), navigator_t::get_y(end), navigator_t::get_z(end), [&clear, &steps] (int X, int Y, int Z) {
+			location_t step = navigator_t::get_xyz(X,Y,Z);
+			if (clear && navigator_t::is_walkable(step)) {
+				steps.push_back(step);
+			} else {
+				clear = false;
+			}
+		});
+		if (clear) return true;
+		return find_path(start, end, steps);
+	}
+
+private:
+	typedef AStarSearch<map_search_node<location_t, navigator_t>> search_t;
+	search_t a_star_search;
+};
+
+namespace path_finding_detail {
+
+// The free find_path functions share a path finder per thread (and per navigator), and copy its result.
+template<class location_t, class navigator_t>
+struct shared_finder {
+	path_finder<location_t, navigator_t> finder;
+	std::vector<location_t> steps;
+
+	static shared_finder &get() {
+		static thread_local shared_finder instance;
+		return instance;
+	}
+
+	std::shared_ptr<navigation_path<location_t>> result(const bool success, const location_t &end) {
+		std::shared_ptr<navigation_path<location_t>> path = std::make_shared<navigation_path<location_t>>();
+		if (success) {
+			path->success = true;
+			path->destination = end;
+			path->steps.assign(steps.begin(), steps.end());
+		}
+		return path;
+	}
+};
+
+}
+
 /*
  * find_path_3d implements A*, and provides an optimization that scans a 3D Bresenham line at the beginning
  * to check for a simple line-of-sight (and paths along it). 
@@ -90,53 +241,8 @@ struct navigation_path {
 template<class location_t, class navigator_t>
 std::shared_ptr<navigation_path<location_t>> find_path_3d(const location_t start, const location_t end) 
 {
-	{
-		std::shared_ptr<navigation_path<location_t>> result = std::shared_ptr<navigation_path<location_t>>(new navigation_path<location_t>());
-		result->success = true;
-		line_func3d(navigator_t::get_x(start), navigator_t::get_y(start), navigator_t::get_z(start), navigator_t::get_x(end), navigator_t::get_y(end), navigator_t::get_z(end), [result] (int X, int Y, int Z) {
-			location_t step = navigator_t::get_xyz(X,Y, Z);
-			if (result->success and navigator_t::is_walkable(step)) {
-				result->steps.push_back(step);
-			} else {
-				result->success = false;
-			}
-		});
-		if (result->success) {
-			return result;
-		}
-	}
-
-	AStarSearch<map_search_node<location_t, navigator_t>> a_star_search;
-	map_search_node<location_t, navigator_t> a_start(start);
-	map_search_node<location_t, navigator_t> a_end(end);
-
-	a_star_search.SetStartAndGoalStates(a_start, a_end);
-	unsigned int search_state;
-	unsigned int search_steps = 0;
-
-	do {
-		search_state = a_star_search.SearchStep();
-		++search_steps;
-	} while (search_state == AStarSearch<map_search_node<navigator_t, location_t>>::SEARCH_STATE_SEARCHING);
-
-	if (search_state == AStarSearch<map_search_node<navigator_t, location_t>>::SEARCH_STATE_SUCCEEDED) {
-		std::shared_ptr<navigation_path<location_t>> result = std::shared_ptr<navigation_path<location_t>>(new navigation_path<location_t>());
-		result->destination = end;
-		map_search_node<location_t, navigator_t> * node = a_star_search.GetSolutionStart();
-		for (;;) {
-			node = a_star_search.GetSolutionNext();
-			if (!node) break;
-			result->steps.push_back(node->pos);
-		}
-		a_star_search.FreeSolutionNodes();
-		a_star_search.EnsureMemoryFreed();
-		result->success = true;
-		return result;
-	}
-
-	std::shared_ptr<navigation_path<location_t>> result = std::make_shared<navigation_path<location_t>>();
-	a_star_search.EnsureMemoryFreed();
-	return result;
+	auto &shared = path_finding_detail::shared_finder<location_t, navigator_t>::get();
+	return shared.result(shared.finder.find_path_3d(start, end, shared.steps), end);
 }
 
 /*
@@ -151,53 +257,8 @@ std::shared_ptr<navigation_path<location_t>> find_path_3d(const location_t start
 template<class location_t, class navigator_t>
 std::shared_ptr<navigation_path<location_t>> find_path_2d(const location_t start, const location_t end) 
 {
-	{
-		std::shared_ptr<navigation_path<location_t>> result = std::shared_ptr<navigation_path<location_t>>(new navigation_path<location_t>());
-		result->success = true;
-		line_func(navigator_t::get_x(start), navigator_t::get_y(start), navigator_t::get_x(end), navigator_t::get_y(end), [result] (int X, int Y) {
-			location_t step = navigator_t::get_xy(X,Y);
-			if (result->success && navigator_t::is_walkable(step)) {
-				result->steps.push_back(step);
-			} else {
-				result->success = false;
-			}
-		});
-		if (result->success) {
-			return result;
-		}
-	}
-
-	AStarSearch<map_search_node<location_t, navigator_t>> a_star_search;
-	map_search_node<location_t, navigator_t> a_start(start);
-	map_search_node<location_t, navigator_t> a_end(end);
-
-	a_star_search.SetStartAndGoalStates(a_start, a_end);
-	unsigned int search_state;
-	unsigned int search_steps = 0;
-
-	do {
-		search_state = a_star_search.SearchStep();
-		++search_steps;
-	} while (search_state == AStarSearch<map_search_node<navigator_t, location_t>>::SEARCH_STATE_SEARCHING);
-
-	if (search_state == AStarSearch<map_search_node<navigator_t, location_t>>::SEARCH_STATE_SUCCEEDED) {
-		std::shared_ptr<navigation_path<location_t>> result = std::shared_ptr<navigation_path<location_t>>(new navigation_path<location_t>());
-		result->destination = end;
-		map_search_node<location_t, navigator_t> * node = a_star_search.GetSolutionStart();
-		for (;;) {
-			node = a_star_search.GetSolutionNext();
-			if (!node) break;
-			result->steps.push_back(node->pos);
-		}
-		a_star_search.FreeSolutionNodes();
-		a_star_search.EnsureMemoryFreed();
-		result->success = true;
-		return result;
-	}
-
-	std::shared_ptr<navigation_path<location_t>> result = std::make_shared<navigation_path<location_t>>();
-	a_star_search.EnsureMemoryFreed();
-	return result;
+	auto &shared = path_finding_detail::shared_finder<location_t, navigator_t>::get();
+	return shared.result(shared.finder.find_path_2d(start, end, shared.steps), end);
 }
 
 /*
@@ -208,37 +269,8 @@ std::shared_ptr<navigation_path<location_t>> find_path_2d(const location_t start
 template<class location_t, class navigator_t>
 std::shared_ptr<navigation_path<location_t>> find_path(const location_t start, const location_t end) 
 {
-	AStarSearch<map_search_node<location_t, navigator_t>> a_star_search;
-	map_search_node<location_t, navigator_t> a_start(start);
-	map_search_node<location_t, navigator_t> a_end(end);
-
-	a_star_search.SetStartAndGoalStates(a_start, a_end);
-	unsigned int search_state;
-	std::size_t search_steps = 0;
-
-	do {
-		search_state = a_star_search.SearchStep();
-		++search_steps;
-	} while (search_state == AStarSearch<map_search_node<navigator_t, location_t>>::SEARCH_STATE_SEARCHING);
-
-	if (search_state == AStarSearch<map_search_node<navigator_t, location_t>>::SEARCH_STATE_SUCCEEDED) {
-		std::shared_ptr<navigation_path<location_t>> result = std::shared_ptr<navigation_path<location_t>>(new navigation_path<location_t>());
-		result->destination = end;
-		map_search_node<location_t, navigator_t> * node = a_star_search.GetSolutionStart();
-		for (;;) {
-			node = a_star_search.GetSolutionNext();
-			if (!node) break;
-			result->steps.push_back(node->pos);
-		}
-		a_star_search.FreeSolutionNodes();
-		a_star_search.EnsureMemoryFreed();
-		result->success = true;
-		return result;
-	}
-
-	std::shared_ptr<navigation_path<location_t>> result = std::make_shared<navigation_path<location_t>>();
-	a_star_search.EnsureMemoryFreed();
-	return result;
+	auto &shared = path_finding_detail::shared_finder<location_t, navigator_t>::get();
+	return shared.result(shared.finder.find_path(start, end, shared.steps), end);
 }
 
 }
@@ -0,0 +1,247 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Batched path queries, run on the thread pool and answered through the ECS message bus.
+ */
+
+#include "path_finding.hpp"
+#include "ecs.hpp"
+#include "thread_pool.hpp"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <limits>
+
+namespace rltk {
+
+/*
+ * Sent (with emit_deferred) when a path query has been answered. path is the same as find_path would return.
+ */
+template<class location_t, class navigator_t>
+struct path_result_message : base_message_t {
+	path_result_message() {}
+	path_result_message(const std::size_t ticket, const std::size_t owner, const location_t start, const location_t end,
+		std::shared_ptr<navigation_path<location_t>> path) : ticket(ticket), owner(owner), start(start), end(end), path(path) {}
+
+	std::size_t ticket = 0;
+	std::size_t owner = 0;
+	location_t start;
+	location_t end;
+	std::shared_ptr<navigation_path<location_t>> path;
+};
+
+/*
+ * path_query_service lets systems ask for paths without searching inside their own update. Call request from
+ * anywhere, and process() once per tick (from a system of its own, for example); process runs up to budget
+ * searches at once on the thread pool and sends each answer as a path_result_message<location_t, navigator_t>.
+ * Subscribe to that message to receive them. Searches over budget wait for the next call, oldest first.
+ *
+ * Requests with the same start and end (as judged by navigator_t::is_same_state) share one search. A request
+ * can be cancelled by ticket; and a request made on behalf of an owner (such as an entity id) replaces that
+ * owner's previous unanswered request, so an agent that changes its mind doesn't wait for a path it no longer
+ * wants.
+ *
+ * Searches run while process() waits, so the map must not change during it - but is free to change between
+ * calls. The search function must be safe to call from several threads at once; the free find_path,
+ * find_path_2d and find_path_3d functions are (the default is find_path_2d).
+ */
+template<class location_t, class navigator_t>
+class path_query_service {
+public:
+	typedef path_result_message<location_t, navigator_t> result_message;
+	typedef std::function<std::shared_ptr<navigation_path<location_t>>(const location_t, const location_t)> search_function;
+
+	/*
+	 * Requests made without an owner.
+	 */
+	static constexpr std::size_t no_owner = std::numeric_limits<std::size_t>::max();
+
+	explicit path_query_service(const std::size_t budget = 64, ecs &ECS = default_ecs,
+		search_function search = [] (const location_t start, const location_t end) { return find_path_2d<location_t, navigator_t>(start, end); }) :
+		budget(budget), ECS(ECS), search(search) {}
+
+	/*
+	 * Queues a search from start to end, returning a ticket that identifies its result message.
+	 */
+	std::size_t request(const location_t start, const location_t end, const std::size_t owner = no_owner) {
+		std::lock_guard<std::mutex> guard(lock);
+		const std::size_t ticket = next_ticket++;
+		if (owner != no_owner) {
+			auto previous = owner_tickets.find(owner);
+			if (previous != owner_tickets.end()) cancel_ticket(previous->second);
+			owner_tickets[owner] = ticket;
+		}
+
+		location_t s = start;
+		location_t e = end;
+		const std::size_t key = path_finding_detail::hash_location<navigator_t>(s, typename path_finding_detail::has_get_z<navigator_t, location_t>::type())
+			^ (path_finding_detail::hash_location<navigator_t>(e, typename path_finding_detail::has_get_z<navigator_t, location_t>::type()) * 31u);
+
+		std::size_t job_id = 0;
+		bool found = false;
+		auto range = pending_keys.equal_range(key);
+		for (auto it = range.first; it != range.second; ++it) {
+			job_t &job = jobs[it->second];
+			if (navigator_t::is_same_state(job.start, s) && navigator_t::is_same_state(job.end, e)) {
+				job_id = it->second;
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			job_id = next_job++;
+			job_t &job = jobs[job_id];
+			job.start = start;
+			job.end = end;
+			job.key = key;
+			pending_keys.emplace(key, job_id);
+			queue.push_back(job_id);
+		}
+		jobs[job_id].requests.push_back(request_t{ticket, owner});
+		ticket_jobs[ticket] = job_id;
+		return ticket;
+	}
+
+	/*
+	 * Cancels an unanswered request. Returns false if there was no such request (or it was already answered).
+	 */
+	bool cancel(const std::size_t ticket) {
+		std::lock_guard<std::mutex> guard(lock);
+		return cancel_ticket(ticket);
+	}
+
+	/*
+	 * Cancels every unanswered request.
+	 */
+	void cancel_all() {
+		std::lock_guard<std::mutex> guard(lock);
+		jobs.clear();
+		queue.clear();
+		pending_keys.clear();
+		ticket_jobs.clear();
+		owner_tickets.clear();
+	}
+
+	/*
+	 * Runs up to budget of the waiting searches, and sends their results. Returns the number of searches run.
+	 */
+	std::size_t process() {
+		std::vector<job_t> batch;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			while (!queue.empty() && batch.size() < budget) {
+				const std::size_t job_id = queue.front();
+				queue.pop_front();
+				auto job = jobs.find(job_id);
+				if (job == jobs.end()) continue; // Every request for it was cancelled
+
+				erase_key(job->second.key, job_id);
+				for (const request_t &r : job->second.requests) {
+					ticket_jobs.erase(r.ticket);
+					if (r.owner != no_owner) owner_tickets.erase(r.owner);
+				}
+				batch.push_back(std::move(job->second));
+				jobs.erase(job);
+			}
+		}
+		if (batch.empty()) return 0;
+
+		std::vector<std::shared_ptr<navigation_path<location_t>>> results(batch.size());
+		default_thread_pool().parallel_for(batch.size(), [this, &batch, &results] (const std::size_t i) {
+			results[i] = search(batch[i].start, batch[i].end);
+		});
+
+		for (std::size_t i=0; i<batch.size(); ++i) {
+			// Each requester gets its own copy, since following a path consumes its steps
+			for (std::size_t r=0; r<batch[i].requests.size(); ++r) {
+				std::shared_ptr<navigation_path<location_t>> path = r == 0 ? results[i] : std::make_shared<navigation_path<location_t>>(*results[i]);
+				ECS.template emit_deferred<result_message>(result_message(batch[i].requests[r].ticket, batch[i].requests[r].owner,
+					batch[i].start, batch[i].end, path));
+			}
+		}
+		return batch.size();
+	}
+
+	/*
+	 * The number of searches waiting to run (each may answer several requests).
+	 */
+	std::size_t pending() {
+		std::lock_guard<std::mutex> guard(lock);
+		return jobs.size();
+	}
+
+	/*
+	 * The maximum number of searches run by each call to process.
+	 */
+	std::size_t budget;
+
+private:
+	struct request_t {
+		std::size_t ticket;
+		std::size_t owner;
+	};
+
+	struct job_t {
+		location_t start;
+		location_t end;
+		std::size_t key = 0;
+		std::vector<request_t> requests;
+	};
+
+	ecs &ECS;
+	search_function search;
+	std::mutex lock;
+	std::size_t next_ticket = 0;
+	std::size_t next_job = 0;
+	std::unordered_map<std::size_t, job_t> jobs;
+	std::deque<std::size_t> queue;
+	std::unordered_multimap<std::size_t, std::size_t> pending_keys;
+	std::unordered_map<std::size_t, std::size_t> ticket_jobs;
+	std::unordered_map<std::size_t, std::size_t> owner_tickets;
+
+	void erase_key(const std::size_t key, const std::size_t job_id) {
+		auto range = pending_keys.equal_range(key);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->second == job_id) {
+				pending_keys.erase(it);
+				return;
+			}
+		}
+	}
+
+	bool cancel_ticket(const std::size_t ticket) {
+		auto found = ticket_jobs.find(ticket);
+		if (found == ticket_jobs.end()) return false;
+		const std::size_t job_id = found->second;
+		ticket_jobs.erase(found);
+
+		job_t &job = jobs[job_id];
+		for (auto it = job.requests.begin(); it != job.requests.end(); ++it) {
+			if (it->ticket == ticket) {
+				if (it->owner != no_owner) {
+					auto owner = owner_tickets.find(it->owner);
+					if (owner != owner_tickets.end() && owner->second == ticket) owner_tickets.erase(owner);
+				}
+				job.requests.erase(it);
+				break;
+			}
+		}
+		if (job.requests.empty()) {
+			// Left in the queue; process skips it
+			erase_key(job.key, job_id);
+			jobs.erase(job_id);
+		}
+		return true;
+	}
+};
+
+template<class location_t, class navigator_t>
+constexpr std::size_t path_query_service<location_t, navigator_t>::no_owner;
+
+}
@@ -14,12 +14,18 @@
 #include "rng.hpp"
 #include "geometry.hpp"
 #include "path_finding.hpp"
+#include "path_cache.hpp"
+#include "grid_path_finding.hpp"
+#include "dijkstra_map.hpp"
+#include "hierarchical_path_finding.hpp"
 #include "input_handler.hpp"
 #include "visibility.hpp"
 #include "gui.hpp"
 #include "ecs.hpp"
+#include "path_query.hpp"
 #include "perlin_noise.hpp"
 #include "serialization_utils.hpp"
+#include "compressed_stream.hpp"
 #include "rexspeeder.hpp"
 #include "scaling.hpp"
 
@@ -0,0 +1,106 @@
+#include "thread_pool.hpp"
+
+namespace rltk {
+
+namespace thread_pool_detail {
+	// The pool (if any) that owns the current thread, and the thread's queue index within it.
+	thread_local thread_pool * owner = nullptr;
+	thread_local std::size_t owner_index = 0;
+}
+
+thread_pool::thread_pool(const std::size_t num_threads) {
+	std::size_t n = num_threads;
+	if (n == 0) n = std::thread::hardware_concurrency();
+	if (n == 0) n = 1;
+
+	for (std::size_t i=0; i<n; ++i) {
+		queues.push_back(std::make_unique<work_queue>());
+	}
+	for (std::size_t i=0; i<n; ++i) {
+		workers.emplace_back([this, i] () { worker_loop(i); });
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread &t : workers) {
+		if (t.joinable()) t.join();
+	}
+}
+
+void thread_pool::submit(std::function<void()> task) {
+	std::size_t idx;
+	if (thread_pool_detail::owner == this) {
+		idx = thread_pool_detail::owner_index;
+	} else {
+		idx = next_queue++ % queues.size();
+	}
+	{
+		std::lock_guard<std::mutex> guard(queues[idx]->lock);
+		queues[idx]->tasks.push_back(std::move(task));
+	}
+	++queued;
+	{
+		// Taking the lock ensures a worker that just found nothing to do is either waiting, or will see the task.
+		std::lock_guard<std::mutex> guard(sleep_lock);
+	}
+	wake.notify_one();
+}
+
+bool thread_pool::pop(const std::size_t &idx, std::function<void()> &task) {
+	std::lock_guard<std::mutex> guard(queues[idx]->lock);
+	if (queues[idx]->tasks.empty()) return false;
+	task = std::move(queues[idx]->tasks.back());
+	queues[idx]->tasks.pop_back();
+	--queued;
+	return true;
+}
+
+bool thread_pool::steal(const std::size_t &idx, std::function<void()> &task) {
+	std::lock_guard<std::mutex> guard(queues[idx]->lock);
+	if (queues[idx]->tasks.empty()) return false;
+	task = std::move(queues[idx]->tasks.front());
+	queues[idx]->tasks.pop_front();
+	--queued;
+	return true;
+}
+
+bool thread_pool::run_pending_task() {
+	if (queued == 0) return false;
+
+	const bool own = thread_pool_detail::owner == this;
+	const std::size_t start = own ? thread_pool_detail::owner_index : 0;
+	std::function<void()> task;
+
+	bool found = own && pop(start, task);
+	for (std::size_t i=0; !found && i<queues.size(); ++i) {
+		found = steal((start + i) % queues.size(), task);
+	}
+	if (!found) return false;
+
+	task();
+	return true;
+}
+
+void thread_pool::worker_loop(const std::size_t idx) {
+	thread_pool_detail::owner = this;
+	thread_pool_detail::owner_index = idx;
+
+	while (!stopping) {
+		if (run_pending_task()) continue;
+
+		std::unique_lock<std::mutex> guard(sleep_lock);
+		wake.wait(guard, [this] () { return stopping || queued > 0; });
+	}
+}
+
+thread_pool &default_thread_pool() {
+	static thread_pool pool;
+	return pool;
+}
+
+}
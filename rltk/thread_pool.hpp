@@ -0,0 +1,132 @@
+#pragma once
+
+/* RLTK (RogueLike Tool Kit) 1.00
+ * Copyright (c) 2016-Present, Bracket Productions.
+ * Licensed under the MIT license - see LICENSE file.
+ *
+ * Work-stealing thread pool, used by the parallel parts of the ECS.
+ */
+
+#include <functional>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+namespace rltk {
+
+/*
+ * Each worker owns a queue of tasks. Workers take work from the back of their own queue, and when it runs
+ * dry steal from the front of the others'. Tasks submitted from a worker go onto that worker's queue (so
+ * nested work stays local); tasks submitted from elsewhere are spread round-robin.
+ *
+ * Threads waiting for work to finish should use wait_until, which runs queued tasks while it waits - so
+ * a task may safely submit more work and wait for it.
+ */
+class thread_pool {
+public:
+	/*
+	 * Starts num_threads workers; 0 uses the number of hardware threads.
+	 */
+	explicit thread_pool(const std::size_t num_threads = 0);
+	~thread_pool();
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool &operator=(const thread_pool &) = delete;
+
+	/*
+	 * Queues a task for execution.
+	 */
+	void submit(std::function<void()> task);
+
+	/*
+	 * Runs one queued task on the calling thread, if there is one. Returns false if there was nothing to do.
+	 */
+	bool run_pending_task();
+
+	/*
+	 * Helps with queued work until done() returns true.
+	 */
+	template <typename F>
+	inline void wait_until(F &&done) {
+		while (!done()) {
+			if (!run_pending_task()) std::this_thread::yield();
+		}
+	}
+
+	/*
+	 * Runs task(0) ... task(count-1) on the pool, and returns once they are all done. If any throw, the first
+	 * exception is rethrown once they have all finished.
+	 *
+	 * While it waits, the calling thread only helps with this batch - never with unrelated queued work (such
+	 * as another system, under ecs_tick_parallel) - so whatever it was doing isn't mixed up with other tasks.
+	 */
+	template <typename F>
+	void parallel_for(const std::size_t count, F &&task) {
+		if (count == 0) return;
+
+		// Shared with the helper tasks, which may only start after the batch is finished (finding nothing to do)
+		struct batch_t {
+			std::atomic<std::size_t> next{0};
+			std::atomic<std::size_t> done{0};
+			std::mutex error_lock;
+			std::exception_ptr error;
+		};
+		std::shared_ptr<batch_t> batch = std::make_shared<batch_t>();
+
+		auto run = [&task, count] (batch_t &b) {
+			for (std::size_t i = b.next++; i < count; i = b.next++) {
+				try {
+					task(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> guard(b.error_lock);
+					if (!b.error) b.error = std::current_exception();
+				}
+				++b.done;
+			}
+		};
+
+		const std::size_t helpers = std::min(count - 1, workers.size());
+		for (std::size_t i=0; i<helpers; ++i) {
+			submit([batch, run] () { run(*batch); });
+		}
+		run(*batch);
+		while (batch->done < count) std::this_thread::yield();
+		if (batch->error) std::rethrow_exception(batch->error);
+	}
+
+	/*
+	 * The number of worker threads.
+	 */
+	inline std::size_t size() const noexcept { return workers.size(); }
+
+private:
+	struct work_queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<work_queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<bool> stopping{false};
+	std::atomic<std::size_t> queued{0};
+	std::atomic<std::size_t> next_queue{0};
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+
+	bool pop(const std::size_t &idx, std::function<void()> &task);
+	bool steal(const std::size_t &idx, std::function<void()> &task);
+	void worker_loop(const std::size_t idx);
+};
+
+/*
+ * Shared pool, created on first use with one worker per hardware thread.
+ */
+thread_pool &default_thread_pool();
+
+}
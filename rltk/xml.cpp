@@ -1,5 +1,4 @@
 #include "xml.hpp"
-#include <stack>
 #include <algorithm> 
 #include <functional> 
 #include <cctype>
@@ -7,8 +6,6 @@
 #include <iostream>
 #include <string>
 
-using namespace std::string_literals;
-
 namespace rltk {
 
 xml_node * xml_node::add_node(const std::string &name) {
@@ -17,7 +14,7 @@ xml_node * xml_node::add_node(const std::string &name) {
 }
 
 void xml_node::add_node(xml_node x) {
-    children.push_back(x);
+    children.push_back(std::move(x));
 }
 
 std::string xml_node::indent() const {
@@ -26,7 +23,7 @@ std::string xml_node::indent() const {
     return result;
 }
 
-void xml_node::save(std::ofstream &lbfile) const {
+void xml_node::save(std::ostream &lbfile) const {
     lbfile << indent() << "<" << name << ">\n";
     for (const auto & val : values) {
         lbfile << indent() << " <" << val.first << ":value>" << val.second << "</" << val.first << ":value>\n";
@@ -37,6 +34,99 @@ void xml_node::save(std::ofstream &lbfile) const {
     lbfile << indent() << "</" << name << ">\n";
 }
 
+/* As save, but indented as though the node were at_depth deep - for nodes built separately from the tree */
+void xml_node::save(std::ostream &lbfile, const int at_depth) const {
+    const std::string pad(static_cast<std::size_t>(at_depth), ' ');
+    lbfile << pad << "<" << name << ">\n";
+    for (const auto & val : values) {
+        lbfile << pad << " <" << val.first << ":value>" << val.second << "</" << val.first << ":value>\n";
+    }
+    for (const xml_node &child : children) {
+        child.save(lbfile, at_depth+1);
+    }
+    lbfile << pad << "</" << name << ">\n";
+}
+
+void xml_stream_writer::begin_node(const std::string &name) {
+    *lbfile << std::string(open_nodes.size(), ' ') << "<" << name << ">\n";
+    open_nodes.push_back(name);
+}
+
+void xml_stream_writer::end_node() {
+    if (open_nodes.empty()) return;
+    const std::string name = open_nodes.back();
+    open_nodes.pop_back();
+    *lbfile << std::string(open_nodes.size(), ' ') << "</" << name << ">\n";
+}
+
+void xml_stream_writer::add_value(const std::string &key, const std::string &val) {
+    *lbfile << std::string(open_nodes.size() > 0 ? open_nodes.size()-1 : 0, ' ') << " <" << key << ":value>" << val << "</" << key << ":value>\n";
+}
+
+void xml_stream_writer::write(const xml_node &node) {
+    node.save(*lbfile, static_cast<int>(open_nodes.size()));
+}
+
+void xml_stream_writer::close() {
+    while (!open_nodes.empty()) end_node();
+    if (lbfile) lbfile->flush();
+}
+
+xml_pull_reader::event_t xml_pull_reader::next() {
+    while (getline(*lbfile, line)) {
+        std::size_t start = 0;
+        while (start < line.size() && std::isspace(static_cast<unsigned char>(line[start]))) ++start;
+        if (start == line.size() || line[start] != '<') continue;
+
+        if (start+1 < line.size() && line[start+1] == '/') {
+            // </name>
+            const std::size_t end = line.find('>', start);
+            current_name.assign(line, start+2, end == std::string::npos ? std::string::npos : end - start - 2);
+            current_value.clear();
+            current_depth = --open_depth;
+            current = END_NODE;
+            return current;
+        }
+
+        const std::size_t close = line.find('>', start);
+        const std::size_t colon = line.find(":value>", start);
+        if (colon != std::string::npos && colon + 6 == close) {
+            // <key:value>value</key:value>
+            current_name.assign(line, start+1, colon - start - 1);
+            const std::size_t value_start = colon + 7;
+            const std::size_t value_end = line.find('<', value_start);
+            current_value.assign(line, value_start, value_end == std::string::npos ? std::string::npos : value_end - value_start);
+            current_depth = open_depth;
+            current = VALUE;
+            return current;
+        }
+
+        // <name>
+        current_name.assign(line, start+1, close == std::string::npos ? std::string::npos : close - start - 1);
+        current_value.clear();
+        current_depth = open_depth++;
+        current = START_NODE;
+        return current;
+    }
+    current = END_OF_FILE;
+    return current;
+}
+
+xml_node xml_pull_reader::read_node() {
+    if (current != START_NODE) throw std::runtime_error("xml_pull_reader::read_node must follow a START_NODE");
+    xml_node result(current_name, current_depth);
+    while (next() != END_OF_FILE) {
+        if (current == VALUE) {
+            result.add_value(current_name, current_value);
+        } else if (current == START_NODE) {
+            result.children.push_back(read_node());
+        } else {
+            return result;
+        }
+    }
+    throw std::runtime_error(std::string("Unexpected end of file in element: ") + result.name);
+}
+
 void xml_node::dump(std::stringstream &lbfile) const {
     lbfile << indent() << "<" << name << ">\n";
     for (const auto & val : values) {
@@ -58,71 +148,67 @@ void xml_node::add_value(const std::string &key, const std::string &val) {
     values.emplace_back(std::make_pair(key, val));
 }
 
-static inline std::string &ltrim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-            std::not1(std::ptr_fun<int, int>(std::isspace))));
-    return s;
-}
-
-static inline void erase_all(std::string &s, const std::string &to_remove) {
-    auto pos = s.find(to_remove);
-    while (pos != std::string::npos) {
-        s.erase(pos, to_remove.size());
-	pos = s.find(to_remove);
+/*
+ * Single pass over the whole file: nodes are built in place in their parent's children, with a stack of
+ * pointers to the currently open ones. A node's children vector only grows while it is the innermost open
+ * node, so the pointers to its ancestors stay valid.
+ */
+void xml_reader::load() {
+    std::string buffer;
+    lbfile->seekg(0, std::ios::end);
+    const std::streamoff size = lbfile->tellg();
+    if (size > 0) {
+        buffer.resize(static_cast<std::size_t>(size));
+        lbfile->seekg(0, std::ios::beg);
+        lbfile->read(&buffer[0], size);
+        buffer.resize(static_cast<std::size_t>(lbfile->gcount()));
+    } else {
+        lbfile->clear();
+        lbfile->seekg(0, std::ios::beg);
+        std::stringstream ss;
+        ss << lbfile->rdbuf();
+        buffer = ss.str();
     }
-}
-
-static inline std::string remove_xml_braces(std::string s) {
-    erase_all(s, "<");
-    erase_all(s, ">");
-    return s;
-}
 
-static inline std::string remove_colon_value(std::string s) {
-    erase_all(s, ":value");
-    return s;
-}
-
-void xml_reader::load() {
-    std::stack<xml_node> stack;
+    const char * pos = buffer.data();
+    const char * const end = pos + buffer.size();
+    static const char value_suffix[] = ":value";
+    constexpr std::size_t value_suffix_length = sizeof(value_suffix) - 1;
+
+    std::vector<xml_node *> open;
+    while (pos < end) {
+        pos = std::find(pos, end, '<');
+        if (pos == end) break;
+        const char * tag_end = std::find(pos, end, '>');
+        if (tag_end == end) break;
+
+        if (pos + 1 < tag_end && pos[1] == '/') {
+            // Closing tag
+            if (!open.empty()) open.pop_back();
+            pos = tag_end + 1;
+            continue;
+        }
 
-    bool first_line = true;
-    std::string line;
-    while (getline(*lbfile, line)) {
-        std::string trimmed = ltrim(line);
-        erase_all(trimmed, "\n");
-
-        if (first_line) {
-            root.name = remove_xml_braces(trimmed);
-            first_line = false;
-        } else if (trimmed == "</"s + root.name + ">"s) {
-            // We're at the end.
-        } else if (stack.empty()) {
-            // We're at the beginning, so we need to create a node.
-            stack.push(xml_node(remove_xml_braces(trimmed)));
-        } else if (trimmed == "</"s + stack.top().name + ">"s ) {
-            // We're at the end of the element
-            if (stack.size() > 1) {
-                xml_node current = stack.top();
-                stack.pop();
-                stack.top().add_node(current);
-            } else {
-                xml_node current = stack.top();
-                stack.pop();
-                root.add_node(current);
-            }
+        const char * name = pos + 1;
+        const std::size_t name_length = static_cast<std::size_t>(tag_end - name);
+        if (name_length >= value_suffix_length &&
+                std::equal(value_suffix, value_suffix + value_suffix_length, tag_end - value_suffix_length)) {
+            // <key:value>value</key:value>
+            const char * value = tag_end + 1;
+            const char * value_end = std::find(value, end, '<');
+            xml_node * target = open.empty() ? &root : open.back();
+            target->values.emplace_back(std::string(name, name_length - value_suffix_length), std::string(value, value_end));
+            pos = std::find(value_end, end, '>');
+            if (pos != end) ++pos;
+        } else if (open.empty() && root.name.empty()) {
+            root.name.assign(name, name_length);
+            open.push_back(&root);
+            pos = tag_end + 1;
         } else {
-            // Are we looking at a new node or a value?
-            if (trimmed.find(":value>")==std::string::npos) {
-                // It's a new child
-                stack.push(xml_node(remove_xml_braces(trimmed)));
-            } else {
-                // It's a value
-                std::string key = remove_colon_value(remove_xml_braces(trimmed.substr(0,trimmed.find(">"))));
-                std::string val = trimmed.substr(trimmed.find(">")+1);
-                val = val.substr(0, val.find("<"));
-                stack.top().add_value(key, val);
-            }
+            xml_node * parent = open.empty() ? &root : open.back();
+            parent->children.emplace_back(std::string(name, name_length), parent->depth + 1);
+            open.push_back(&parent->children.back());
+            pos = tag_end + 1;
         }
     }
 }
@@ -7,6 +7,10 @@
 #include <memory>
 #include <sstream>
 #include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <cstdlib>
 #include "color_t.hpp"
 #include "vchar.hpp"
 #include "filesystem.hpp"
@@ -34,6 +38,72 @@ inline std::string from_string(const std::string &val) {
     return val;
 }
 
+/*
+ * Numeric conversions skip the stringstream, and parse directly with the C library.
+ */
+template<>
+inline short from_string(const std::string &val) {
+    return static_cast<short>(std::strtol(val.c_str(), nullptr, 10));
+}
+template<>
+inline unsigned short from_string(const std::string &val) {
+    return static_cast<unsigned short>(std::strtoul(val.c_str(), nullptr, 10));
+}
+template<>
+inline int from_string(const std::string &val) {
+    return static_cast<int>(std::strtol(val.c_str(), nullptr, 10));
+}
+template<>
+inline unsigned int from_string(const std::string &val) {
+    return static_cast<unsigned int>(std::strtoul(val.c_str(), nullptr, 10));
+}
+template<>
+inline long from_string(const std::string &val) {
+    return std::strtol(val.c_str(), nullptr, 10);
+}
+template<>
+inline unsigned long from_string(const std::string &val) {
+    return std::strtoul(val.c_str(), nullptr, 10);
+}
+template<>
+inline long long from_string(const std::string &val) {
+    return std::strtoll(val.c_str(), nullptr, 10);
+}
+template<>
+inline unsigned long long from_string(const std::string &val) {
+    return std::strtoull(val.c_str(), nullptr, 10);
+}
+template<>
+inline float from_string(const std::string &val) {
+    return std::strtof(val.c_str(), nullptr);
+}
+template<>
+inline double from_string(const std::string &val) {
+    return std::strtod(val.c_str(), nullptr);
+}
+
+/*
+ * Name to position maps for a node's children and values, so that lookups on nodes with many of them don't
+ * scan. Built on first use, and extended as children and values are added. Copying a node doesn't copy its
+ * index; the copy builds its own if needed.
+ */
+struct xml_node_index {
+    std::unordered_map<std::string, std::size_t> children;
+    std::unordered_map<std::string, std::size_t> values;
+    std::size_t indexed_children = 0;
+    std::size_t indexed_values = 0;
+};
+
+struct xml_lazy_index {
+    xml_lazy_index() = default;
+    xml_lazy_index(const xml_lazy_index &) {}
+    xml_lazy_index(xml_lazy_index &&) = default;
+    xml_lazy_index &operator=(const xml_lazy_index &) { index.reset(); return *this; }
+    xml_lazy_index &operator=(xml_lazy_index &&) = default;
+
+    std::unique_ptr<xml_node_index> index;
+};
+
 struct xml_node {
     xml_node() {};
     xml_node(const std::string &Name) : name(Name) {}
@@ -42,7 +112,8 @@ struct xml_node {
     xml_node * add_node(const std::string &name);
     void add_node(xml_node x);
     std::string indent() const;
-    void save(std::ofstream &lbfile) const;
+    void save(std::ostream &lbfile) const;
+    void save(std::ostream &lbfile, const int at_depth) const;
     void dump(std::stringstream &lbfile) const;
     std::string dump() const;
     void add_value(const std::string &key, const std::string &val);
@@ -64,26 +135,41 @@ struct xml_node {
         }
     }
 
-    xml_node * find(const std::string name) {
-        for (xml_node &node : children) {
-            if (node.name == name) return &node;
+    /*
+     * Nodes with fewer children/values than this are searched linearly; beyond it, a hash index is built.
+     */
+    static constexpr std::size_t index_threshold = 8;
+
+    xml_node * find(const std::string &name) {
+        if (children.size() < index_threshold) {
+            for (xml_node &node : children) {
+                if (node.name == name) return &node;
+            }
+            return nullptr;
+        }
+        xml_node_index &idx = index();
+        if (idx.indexed_children > children.size()) {
+            idx.children.clear();
+            idx.indexed_children = 0;
         }
-        return nullptr;
+        for (; idx.indexed_children < children.size(); ++idx.indexed_children) {
+            idx.children.emplace(children[idx.indexed_children].name, idx.indexed_children);
+        }
+        auto finder = idx.children.find(name);
+        return finder == idx.children.end() ? nullptr : &children[finder->second];
     }
 
     template<typename T>
     T val(const std::string &key) {
-        for (const auto &val : values) {
-            if (val.first == key) {
-                return from_string<T>(val.second);
-            }
-        }
-        throw std::runtime_error(std::string("Key not found:") + key);
+        const std::string * found = find_value(key);
+        if (!found) throw std::runtime_error(std::string("Key not found:") + key);
+        return from_string<T>(*found);
     }
 
     inline void iterate_child(const std::string &name, const std::function<void(xml_node *)> &func) {
         xml_node * vec = find(name);
-        for (xml_node child : vec->children) {
+        if (!vec) return;
+        for (xml_node &child : vec->children) {
             func(&child);
         }
     }
@@ -105,6 +191,32 @@ struct xml_node {
     std::vector<xml_node> children;
     std::vector<std::pair<std::string, std::string>> values;
 
+private:
+    xml_lazy_index lookup;
+
+    inline xml_node_index &index() {
+        if (!lookup.index) lookup.index = std::make_unique<xml_node_index>();
+        return *lookup.index;
+    }
+
+    const std::string * find_value(const std::string &key) {
+        if (values.size() < index_threshold) {
+            for (const auto &val : values) {
+                if (val.first == key) return &val.second;
+            }
+            return nullptr;
+        }
+        xml_node_index &idx = index();
+        if (idx.indexed_values > values.size()) {
+            idx.values.clear();
+            idx.indexed_values = 0;
+        }
+        for (; idx.indexed_values < values.size(); ++idx.indexed_values) {
+            idx.values.emplace(values[idx.indexed_values].first, idx.indexed_values);
+        }
+        auto finder = idx.values.find(key);
+        return finder == idx.values.end() ? nullptr : &values[finder->second].second;
+    }
 };
 
 struct xml_writer {
@@ -113,7 +225,7 @@ struct xml_writer {
 	    lbfile = std::make_unique<std::ofstream>(filename, std::ios::out | std::ios::binary);
     }
 
-    xml_writer(std::unique_ptr<std::ofstream> &&f, const std::string &root_name) : lbfile(std::move(f)), root(xml_node(root_name,0)) {}
+    xml_writer(std::unique_ptr<std::ostream> &&f, const std::string &root_name) : lbfile(std::move(f)), root(xml_node(root_name,0)) {}
 
     inline void commit() {        
         root.save(*lbfile);
@@ -124,11 +236,82 @@ struct xml_writer {
     }
 
 private:
-    std::unique_ptr<std::ofstream> lbfile;
+    std::unique_ptr<std::ostream> lbfile;
     const std::string filename = "";
     xml_node root;
 };
 
+/*
+ * Writes XML in the same format as xml_writer, but directly to the file as it goes rather than building the
+ * whole tree first - so memory use is bounded by the largest node passed to write. Open elements with
+ * begin_node/end_node, and write values or complete subtrees (such as a single component) in between.
+ * Anything still open is closed by close() or the destructor.
+ */
+struct xml_stream_writer {
+    xml_stream_writer(const std::string &fn, const std::string &root_name) {
+        if (exists(fn)) std::remove(fn.c_str());
+        lbfile = std::make_unique<std::ofstream>(fn, std::ios::out | std::ios::binary);
+        begin_node(root_name);
+    }
+
+    xml_stream_writer(std::unique_ptr<std::ostream> &&f, const std::string &root_name) : lbfile(std::move(f)) {
+        begin_node(root_name);
+    }
+
+    ~xml_stream_writer() {
+        close();
+    }
+
+    xml_stream_writer(const xml_stream_writer &) = delete;
+    xml_stream_writer &operator=(const xml_stream_writer &) = delete;
+
+    void begin_node(const std::string &name);
+    void end_node();
+    void add_value(const std::string &key, const std::string &val);
+    void write(const xml_node &node);
+    void close();
+
+private:
+    std::unique_ptr<std::ostream> lbfile;
+    std::vector<std::string> open_nodes;
+};
+
+/*
+ * Reads XML in the format produced by xml_writer and xml_stream_writer one element at a time, without
+ * loading the whole document. Call next() to advance; name() is the element name (or the key, for values),
+ * and value() the value. After START_NODE, read_node() loads the rest of that element (up to and including
+ * its END_NODE) into an xml_node - handy for loading one component at a time with the usual query API.
+ */
+struct xml_pull_reader {
+    enum event_t { START_NODE, VALUE, END_NODE, END_OF_FILE };
+
+    xml_pull_reader(const std::string &fn) {
+        if (!exists(fn)) throw std::runtime_error(std::string("File not found: ") + fn);
+        lbfile = std::make_unique<std::ifstream>(fn, std::ios::in | std::ios::binary);
+    }
+
+    xml_pull_reader(std::unique_ptr<std::istream> &&f) : lbfile(std::move(f)) {}
+
+    event_t next();
+    xml_node read_node();
+
+    inline event_t event() const noexcept { return current; }
+    inline const std::string &name() const noexcept { return current_name; }
+    inline const std::string &value() const noexcept { return current_value; }
+
+    /* Nesting depth of the current element; the root is 0 */
+    inline int depth() const noexcept { return current_depth; }
+
+private:
+    std::unique_ptr<std::istream> lbfile;
+    std::string line;
+    std::string current_name;
+    std::string current_value;
+    event_t current = END_OF_FILE;
+    int current_depth = -1;
+    int open_depth = 0;
+};
+
 struct xml_reader {
     xml_reader(const std::string &fn) : filename(fn) {
         if (!exists(filename)) throw std::runtime_error(std::string("File not found: ") + filename);
@@ -136,14 +319,14 @@ struct xml_reader {
         load();
     }
 
-    xml_reader(std::unique_ptr<std::ifstream> &&f) : lbfile(std::move(f)) {
+    xml_reader(std::unique_ptr<std::istream> &&f) : lbfile(std::move(f)) {
         load();
     }
 
     inline xml_node * get() { return &root; }
 
 private:
-    std::unique_ptr<std::ifstream> lbfile;
+    std::unique_ptr<std::istream> lbfile;
     const std::string filename = "";
     xml_node root;
 